@@ -0,0 +1,136 @@
+/*
+ * parsebench.c - Parse throughput of tsh's tokenizer
+ *
+ * usage: parsebench [<iterations>]
+ * Times parseline on a short line, a line just under MAXLINE and a
+ * 1MB line, and compares the first two against the strchr-based
+ * parseline it replaced (oldparseline, copied below), which could not
+ * handle the long line at all.
+ *
+ */
+#define TSH_NO_MAIN
+#include "tsh.c"
+#include <time.h>
+
+/* The tokenizer tsh used before, including eval's copy of the line */
+int oldparseline(const char *cmdline, char **argv)
+{
+    static char array[MAXLINE]; /* holds local copy of command line */
+    char *buf = array;          /* ptr that traverses command line */
+    char *delim;                /* points to first space delimiter */
+    int argc;                   /* number of args */
+    int bg;                     /* background job? */
+
+    strcpy(buf, cmdline);
+    buf[strlen(buf)-1] = ' ';  /* replace trailing '\n' with space */
+    while (*buf && (*buf == ' ')) /* ignore leading spaces */
+	buf++;
+
+    /* Build the argv list */
+    argc = 0;
+    if (*buf == '\'') {
+	buf++;
+	delim = strchr(buf, '\'');
+    }
+    else {
+	delim = strchr(buf, ' ');
+    }
+
+    while (delim) {
+	argv[argc++] = buf;
+	*delim = '\0';
+	buf = delim + 1;
+	while (*buf && (*buf == ' ')) /* ignore spaces */
+	       buf++;
+
+	if (*buf == '\'') {
+	    buf++;
+	    delim = strchr(buf, '\'');
+	}
+	else {
+	    delim = strchr(buf, ' ');
+	}
+    }
+    argv[argc] = NULL;
+
+    if (argc == 0)  /* ignore blank line */
+	return 1;
+
+    /* should the job run in the background? */
+    if ((bg = (*argv[argc-1] == '&')) != 0) {
+	argv[--argc] = NULL;
+    }
+    return bg;
+}
+
+/* makeline - A line of len bytes (with newline) of 8-character words */
+static char *makeline(size_t len)
+{
+    char *line = Realloc(NULL, len + 1);
+    size_t i;
+
+    for (i = 0; i < len - 1; i++)
+	line[i] = (i % 9 == 8) ? ' ' : 'a' + i % 9;
+    memcpy(line, "/bin/echo", (len > 10) ? 9 : 0);
+    line[len - 1] = '\n';
+    line[len] = '\0';
+    return line;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* bench - Time iters parses of line, with the old or the new parseline */
+static void bench(const char *name, char *line, long iters, int old)
+{
+    char *smallargv[MAXARGS], smallbuf[MAXLINE], cmdline[MAXLINE];
+    unsigned char smallplain[MAXARGS];
+    size_t len = strlen(line);
+    char *buf = (len < MAXLINE) ? smallbuf : Realloc(NULL, len + 1);
+    struct args_t args;
+    double start, secs;
+    long i;
+
+    start = now();
+    for (i = 0; i < iters; i++) {
+	if (old) {
+	    strcpy(cmdline, line);  /* eval's copy */
+	    oldparseline(cmdline, smallargv);
+	    continue;
+	}
+	args.argv = smallargv;
+	args.plain = smallplain;
+	args.cap = MAXARGS;
+	args.heap = 0;
+	parseline(line, buf, &args);
+	if (args.heap) {
+	    free(args.argv);
+	    free(args.plain);
+	}
+    }
+    secs = now() - start;
+    printf("%-4s %-8s %8zu bytes: %10.0f lines/sec %8.1f MB/s\n",
+	   old ? "old" : "new", name, len, iters / secs, len * iters / secs / 1e6);
+    if (buf != smallbuf)
+	free(buf);
+}
+
+int main(int argc, char **argv)
+{
+    long iters = (argc > 1) ? atol(argv[1]) : 1000000;
+    char *shortline = makeline(40);
+    char *fullline = makeline(MAXLINE - 24);
+    char *hugeline = makeline(1 << 20);
+
+    bench("short", shortline, iters, 1);
+    bench("short", shortline, iters, 0);
+    bench("full", fullline, iters / 10, 1);
+    bench("full", fullline, iters / 10, 0);
+    bench("1MB", hugeline, iters / 10000 + 1, 0);
+    exit(0);
+}
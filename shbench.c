@@ -0,0 +1,407 @@
+/*
+ * shbench.c - Performance benchmarks for the shell lab
+ *
+ * usage: shbench [-n <iters>] [-m <maxjobs>] [-J <jsonfile>] <shell>...
+ *
+ * Runs each shell with its prompt on, over a pair of pipes, and measures
+ *     fg_latency     prompt-to-prompt time of a foreground ./myspin 0
+ *     bg_rate        ./myspin 0 & lines run per second
+ *     sigint_fwd     time from a SIGINT sent to the shell until the
+ *                    foreground job's handler runs
+ *     sigtstp_fwd    the same for SIGTSTP
+ *     jobs_latency   prompt-to-prompt time of jobs, with 1, 2, 4, ...
+ *                    background jobs up to <maxjobs> (or as many as the
+ *                    shell can hold)
+ * Latencies are given as the mean, median and 99th percentile over
+ * <iters> runs (default 500; 1/5 as many for the signal and jobs
+ * tests). Results go to stdout as CSV and, with -J, to <jsonfile> as
+ * JSON, so runs can be compared (e.g. tsh against tshref) over time.
+ *
+ * The foreground job of the signal tests is shbench itself, run as
+ * "shbench -w": it prints "ready", and the time at which a SIGINT or
+ * SIGTSTP arrives, then dies of the SIGINT or stops.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define TIMEOUT_MS  10000   /* longest wait for the shell's output */
+#define MAXRESULTS    256   /* results kept for the report */
+#define MAXBGJOBS    4096   /* background jobs of the jobs test */
+
+struct shell {              /* A shell being benchmarked */
+    char *path;             /* the program */
+    pid_t pid;              /* its process */
+    int in;                 /* its stdin */
+    int out;                /* its stdout */
+    char *buf;              /* its output */
+    size_t len;             /* bytes in buf */
+    size_t cap;             /* size of buf */
+    size_t mark;            /* output before mark has been looked at */
+};
+
+struct result {             /* A measurement */
+    char *shell;
+    char *metric;
+    char *stat;             /* mean, p50, p99 or rate */
+    int jobs;               /* background jobs at the time */
+    double value;
+    char *unit;
+};
+
+struct result results[MAXRESULTS];
+int nresults = 0;
+char *self;                 /* how to run shbench -w */
+volatile sig_atomic_t caught = 0;   /* signal the -w job got */
+
+void unix_error(char *msg)
+{
+    fprintf(stderr, "shbench: %s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: shbench [-n <iters>] [-m <maxjobs>] [-J <jsonfile>] <shell>...\n");
+    exit(1);
+}
+
+/* now - Nanoseconds on the monotonic clock */
+long long now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * The -w job: report when SIGINT or SIGTSTP arrives, then act on it
+ * (die, or stop until fg continues us)
+ */
+void onsignal(int sig)
+{
+    char line[64];
+    int n = snprintf(line, sizeof(line), "%s %lld\n", (sig == SIGINT) ? "sigint" : "sigtstp", now());
+
+    if (write(STDOUT_FILENO, line, n) < 0)
+	_exit(1);
+    caught = sig;
+}
+
+void waitjob(void)
+{
+    signal(SIGINT, onsignal);
+    signal(SIGTSTP, onsignal);
+    if (write(STDOUT_FILENO, "ready\n", 6) < 0)
+	exit(1);
+    while (!caught)
+	pause();
+    if (caught == SIGINT) {
+	signal(SIGINT, SIG_DFL);
+	raise(SIGINT);
+    }
+    raise(SIGSTOP);
+    exit(0);
+}
+
+/* startshell - Run sh->path with pipes to and from it */
+void startshell(struct shell *sh, char *path)
+{
+    int in[2], out[2];
+
+    memset(sh, 0, sizeof(*sh));
+    sh->path = path;
+    if (pipe2(in, O_CLOEXEC) < 0 || pipe2(out, O_CLOEXEC) < 0)
+	unix_error("pipe");
+    if ((sh->pid = fork()) < 0)
+	unix_error("fork");
+    if (sh->pid == 0) {
+	dup2(in[0], STDIN_FILENO);
+	dup2(out[1], STDOUT_FILENO);
+	signal(SIGPIPE, SIG_DFL);
+	execl(path, path, (char *)NULL);
+	unix_error(path);
+    }
+    close(in[0]);
+    close(out[1]);
+    sh->in = in[1];
+    sh->out = out[0];
+}
+
+/* send - Send the line (with its newline) to the shell */
+void send(struct shell *sh, const char *line)
+{
+    if (write(sh->in, line, strlen(line)) < 0)
+	unix_error("write to shell");
+}
+
+/*
+ * expect - Wait until the shell's output after sh->mark contains str,
+ *    and move mark past it. Returns where str starts in sh->buf.
+ */
+size_t expect(struct shell *sh, const char *str)
+{
+    long long deadline = now() + TIMEOUT_MS * 1000000LL;
+    struct pollfd pfd;
+    char *hit;
+    ssize_t n;
+    size_t at;
+
+    while (sh->len == 0 || (hit = strstr(sh->buf + sh->mark, str)) == NULL) {
+	if (sh->len + 4096 + 1 > sh->cap) {
+	    sh->cap = 2 * (sh->len + 4096 + 1);
+	    if ((sh->buf = realloc(sh->buf, sh->cap)) == NULL)
+		unix_error("realloc");
+	}
+	pfd.fd = sh->out;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, (int)((deadline - now()) / 1000000)) <= 0 ||
+	    (n = read(sh->out, sh->buf + sh->len, 4096)) <= 0) {
+	    fprintf(stderr, "shbench: %s: no \"%s\" in the output\n", sh->path, str);
+	    exit(1);
+	}
+	sh->len += n;
+	sh->buf[sh->len] = '\0';
+    }
+    at = hit - sh->buf;
+    sh->mark = at + strlen(str);
+    return at;
+}
+
+/* stopshell - Close the shell's input and reap it */
+void stopshell(struct shell *sh)
+{
+    close(sh->in);
+    close(sh->out);
+    waitpid(sh->pid, NULL, 0);
+    free(sh->buf);
+}
+
+/* report - Record a measurement */
+void report(struct shell *sh, char *metric, char *stat, int jobs, double value, char *unit)
+{
+    struct result *r = &results[nresults];
+
+    if (nresults == MAXRESULTS)
+	return;
+    r->shell = sh->path;
+    r->metric = metric;
+    r->stat = stat;
+    r->jobs = jobs;
+    r->value = value;
+    r->unit = unit;
+    nresults++;
+}
+
+int cmpll(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* summarize - Report the mean, median and 99th percentile of n times (ns) in us */
+void summarize(struct shell *sh, char *metric, int jobs, long long *ns, int n)
+{
+    double sum = 0;
+    int i;
+
+    qsort(ns, n, sizeof(*ns), cmpll);
+    for (i = 0; i < n; i++)
+	sum += ns[i];
+    report(sh, metric, "mean", jobs, sum / n / 1000, "us");
+    report(sh, metric, "p50", jobs, ns[n / 2] / 1000.0, "us");
+    report(sh, metric, "p99", jobs, ns[(n * 99) / 100] / 1000.0, "us");
+}
+
+/* benchfg - Prompt-to-prompt time of a foreground command */
+void benchfg(struct shell *sh, int iters, long long *ns)
+{
+    long long t;
+    int i;
+
+    for (i = 0; i < iters; i++) {
+	t = now();
+	send(sh, "./myspin 0\n");
+	expect(sh, "tsh> ");
+	ns[i] = now() - t;
+    }
+    summarize(sh, "fg_latency", 0, ns, iters);
+}
+
+/* benchbg - Background lines run per second, sent all at once */
+void benchbg(struct shell *sh, int iters)
+{
+    long long t = now();
+    int i;
+
+    for (i = 0; i < iters; i++)
+	send(sh, "./myspin 0 &\n");
+    for (i = 0; i < iters; i++)
+	expect(sh, "tsh> ");
+    report(sh, "bg_rate", "rate", 0, iters / ((now() - t) / 1e9), "lines/s");
+
+    /* let them all be reaped before the next test */
+    usleep(200000);
+    send(sh, "jobs\n");
+    expect(sh, "tsh> ");
+}
+
+/*
+ * benchsignal - Time from sending sig to the shell until the FG job's
+ *    handler runs
+ */
+void benchsignal(struct shell *sh, int sig, int iters, long long *ns)
+{
+    char cmd[4096];
+    char *tag = (sig == SIGINT) ? "sigint " : "sigtstp ";
+    long long t;
+    size_t at;
+    int i;
+
+    snprintf(cmd, sizeof(cmd), "%s -w\n", self);
+    for (i = 0; i < iters; i++) {
+	send(sh, cmd);
+	expect(sh, "ready\n");
+	t = now();
+	kill(sh->pid, sig);
+	at = expect(sh, tag);
+	expect(sh, "\n");
+	ns[i] = atoll(sh->buf + at + strlen(tag)) - t;
+	expect(sh, "tsh> ");
+	if (sig == SIGTSTP) {
+	    send(sh, "fg %1\n");
+	    expect(sh, "tsh> ");
+	}
+    }
+    summarize(sh, (sig == SIGINT) ? "sigint_fwd" : "sigtstp_fwd", 0, ns, iters);
+}
+
+/*
+ * benchjobs - Prompt-to-prompt time of jobs with 1, 2, 4, ... BG jobs,
+ *    until maxjobs or until the shell takes no more
+ */
+void benchjobs(struct shell *sh, int maxjobs, int iters, long long *ns)
+{
+    static pid_t pgids[MAXBGJOBS];
+    int njobs = 0, want, listed, i;
+    long long t;
+    size_t start = 0, at = 0;
+    char *p;
+
+    for (want = 1; want <= maxjobs && want <= MAXBGJOBS; want *= 2) {
+	while (njobs < want) {
+	    send(sh, "./myspin 1000 &\n");
+	    start = sh->mark;
+	    at = expect(sh, "tsh> ");
+	    if ((p = memchr(sh->buf + start, '(', at - start)) != NULL)
+		pgids[njobs] = atoi(p + 1);
+	    njobs++;
+	}
+	for (i = 0; i < iters; i++) {
+	    start = sh->mark;
+	    t = now();
+	    send(sh, "jobs\n");
+	    at = expect(sh, "tsh> ");
+	    ns[i] = now() - t;
+	}
+
+	/* the last listing says how many jobs the shell really has */
+	for (listed = 0, p = sh->buf + start; (p = memchr(p, '[', sh->buf + at - p)) != NULL; p++)
+	    listed++;
+	summarize(sh, "jobs_latency", listed, ns, iters);
+	if (listed < want)
+	    break;
+    }
+
+    /* kill them while the shell is still there to reap them */
+    for (i = 0; i < njobs; i++)
+	if (pgids[i] > 0)
+	    kill(-pgids[i], SIGKILL);
+    usleep(200000);
+    send(sh, "jobs\n");
+    expect(sh, "tsh> ");
+}
+
+/* printjson - Write the results to fp as a JSON array */
+void printjson(FILE *fp)
+{
+    int i;
+
+    fprintf(fp, "[\n");
+    for (i = 0; i < nresults; i++)
+	fprintf(fp, "  {\"shell\": \"%s\", \"metric\": \"%s\", \"stat\": \"%s\", \"jobs\": %d, "
+		"\"value\": %.1f, \"unit\": \"%s\"}%s\n", results[i].shell, results[i].metric,
+		results[i].stat, results[i].jobs, results[i].value, results[i].unit,
+		(i < nresults - 1) ? "," : "");
+    fprintf(fp, "]\n");
+}
+
+int main(int argc, char **argv)
+{
+    int iters = 500, maxjobs = 1024, c, i;
+    char *json = NULL;
+    struct shell sh;
+    long long *ns;
+    FILE *fp;
+
+    self = argv[0];
+    while ((c = getopt(argc, argv, "wn:m:J:")) != EOF) {
+	switch (c) {
+	case 'w':
+	    waitjob();
+	    break;
+	case 'n':
+	    iters = atoi(optarg);
+	    break;
+	case 'm':
+	    maxjobs = atoi(optarg);
+	    break;
+	case 'J':
+	    json = optarg;
+	    break;
+	default:
+	    usage();
+	}
+    }
+    if (optind == argc || iters < 5)
+	usage();
+    signal(SIGPIPE, SIG_IGN);
+    unsetenv("TSH_HISTFILE");
+    if ((ns = malloc(iters * sizeof(*ns))) == NULL)
+	unix_error("malloc");
+
+    for (i = optind; i < argc; i++) {
+	startshell(&sh, argv[i]);
+	expect(&sh, "tsh> ");
+	benchfg(&sh, iters, ns);
+	benchbg(&sh, iters);
+	benchsignal(&sh, SIGINT, iters / 5, ns);
+	benchsignal(&sh, SIGTSTP, iters / 5, ns);
+	benchjobs(&sh, maxjobs, iters / 5, ns);
+	stopshell(&sh);
+    }
+
+    printf("shell,metric,stat,jobs,value,unit\n");
+    for (i = 0; i < nresults; i++)
+	printf("%s,%s,%s,%d,%.1f,%s\n", results[i].shell, results[i].metric, results[i].stat,
+	       results[i].jobs, results[i].value, results[i].unit);
+    if (json != NULL) {
+	if ((fp = fopen(json, "w")) == NULL)
+	    unix_error(json);
+	printjson(fp);
+	fclose(fp);
+    }
+    free(ns);
+    exit(0);
+}
@@ -0,0 +1,490 @@
+/*
+ * stormtest.c - Signal-storm stress test of a shell's job control
+ *
+ * usage: stormtest [-d <secs>] [-r <signals/sec>] [-j <maxbg>] [-S <seed>]
+ *                  [-s <shell>] [-w <workload>]
+ *
+ * Keeps the shell (default ./tsh) busy with short foreground and
+ * background ./workload jobs, and fg and bg of its jobs, while sending
+ * random SIGTSTP, SIGINT and SIGCONT to the shell and SIGTSTP, SIGINT,
+ * SIGCONT and SIGKILL to the process groups of its children, together
+ * <signals/sec> (default 2000). At most <maxbg> (default 200) children
+ * are kept. Every quarter second the storm pauses, and once the shell
+ * has caught up, its jobs listing is checked against /proc:
+ *     - no job is in the foreground while the shell is at its prompt
+ *     - every job is a child of the shell, and no two jobs share a PID
+ *     - every child that is alive throughout the check is a job
+ *     - no child that was a zombie before the check still is after it
+ *     - no job listed as Running is stopped throughout the check
+ * After <secs> seconds (default 10) all the children are killed, and
+ * the last check also wants the job list empty. Prints each violation
+ * as it is found and, at the end, the events (commands and signals)
+ * sent per second; the exit status is 1 if there were violations.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define MAXPROCS    4096    /* children of the shell looked at */
+#define MAXJOBS     4096    /* jobs parsed from a listing */
+#define MAXPENDING     4    /* commands sent ahead of the shell */
+#define CHECK_MS     250    /* time between checks */
+#define SETTLE_MS     20    /* time the shell gets to notice signals before a check */
+#define SCAN_MS        5    /* time between looks at the shell's children */
+#define TIMEOUT_MS  5000    /* longest the shell may take to catch up */
+
+struct proc {               /* A child of the shell */
+    pid_t pid;
+    char state;             /* from /proc/<pid>/stat: R, S, T, Z, ... */
+};
+
+struct procs {              /* The children of the shell at some time */
+    struct proc p[MAXPROCS];
+    int n;
+};
+
+struct job {                /* A line of the shell's jobs listing */
+    int jid;
+    pid_t pid;
+    char state[16];         /* Running, Stopped, Foreground or Queued */
+};
+
+struct shell {              /* The shell under test */
+    pid_t pid;
+    int in;                 /* its stdin */
+    int out;                /* its stdout */
+    char *buf;              /* its output not looked at yet */
+    size_t len;
+    size_t cap;
+    long prompts;           /* prompts seen */
+    long sent;              /* command lines sent */
+};
+
+struct shell sh;
+struct procs kids;          /* the children at the last scan */
+struct job jobs[MAXJOBS];   /* the last jobs listing */
+int njobs = 0;
+char *workload = "./workload";
+long long start;            /* when the storm began */
+long nviolations = 0;
+long nsignals = 0;
+long ncommands = 0;
+long nchecks = 0;
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: stormtest [-d <secs>] [-r <signals/sec>] [-j <maxbg>] [-S <seed>]\n"
+	    "                 [-s <shell>] [-w <workload>]\n");
+    exit(1);
+}
+
+void unix_error(char *msg)
+{
+    fprintf(stderr, "stormtest: %s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+/* now - Nanoseconds on the monotonic clock */
+long long now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* violation - Report a broken invariant */
+void violation(const char *fmt, ...)
+{
+    va_list ap;
+
+    printf("stormtest: %.2f s: ", (now() - start) / 1e9);
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+    fflush(stdout);
+    nviolations++;
+}
+
+/*
+ * procstate - Return the state of process pid and set *ppid, or 0 if
+ *    it's gone
+ */
+char procstate(pid_t pid, pid_t *ppid)
+{
+    char path[64], buf[512], *p;
+    char state = 0;
+    ssize_t n;
+    int fd;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    if ((fd = open(path, O_RDONLY)) < 0)
+	return 0;
+    if ((n = read(fd, buf, sizeof(buf) - 1)) > 0) {
+	buf[n] = '\0';
+	if ((p = strrchr(buf, ')')) != NULL &&
+	    sscanf(p + 1, " %c %d", &state, ppid) != 2)
+	    state = 0;
+    }
+    close(fd);
+    return state;
+}
+
+/*
+ * scan - Find the children of the shell, from /proc/<pid>/task/<pid>/children
+ *    or, if the kernel has no such file, from all of /proc
+ */
+void scan(struct procs *ps)
+{
+    char path[64];
+    struct dirent *de;
+    pid_t pid, ppid;
+    FILE *fp;
+    DIR *dir;
+    int n;
+
+    ps->n = 0;
+    snprintf(path, sizeof(path), "/proc/%d/task/%d/children", (int)sh.pid, (int)sh.pid);
+    if ((fp = fopen(path, "r")) != NULL) {
+	while (ps->n < MAXPROCS && fscanf(fp, "%d", &n) == 1) {
+	    ps->p[ps->n].pid = n;
+	    if ((ps->p[ps->n].state = procstate(n, &ppid)) != 0 && ppid == sh.pid)
+		ps->n++;
+	}
+	fclose(fp);
+	return;
+    }
+    if ((dir = opendir("/proc")) == NULL)
+	unix_error("/proc");
+    while (ps->n < MAXPROCS && (de = readdir(dir)) != NULL) {
+	if (!isdigit((unsigned char)de->d_name[0]))
+	    continue;
+	pid = atoi(de->d_name);
+	if ((ps->p[ps->n].state = procstate(pid, &ppid)) != 0 && ppid == sh.pid)
+	    ps->p[ps->n++].pid = pid;
+    }
+    closedir(dir);
+}
+
+/* findproc - Return the state of pid in ps, 0 if it isn't there */
+char findproc(struct procs *ps, pid_t pid)
+{
+    int i;
+
+    for (i = 0; i < ps->n; i++)
+	if (ps->p[i].pid == pid)
+	    return ps->p[i].state;
+    return 0;
+}
+
+/* startshell - Run the shell, with its prompt, over pipes */
+void startshell(char *path)
+{
+    int in[2], out[2];
+
+    if (pipe2(in, O_CLOEXEC) < 0 || pipe2(out, O_CLOEXEC) < 0)
+	unix_error("pipe");
+    if ((sh.pid = fork()) < 0)
+	unix_error("fork");
+    if (sh.pid == 0) {
+	dup2(in[0], STDIN_FILENO);
+	dup2(out[1], STDOUT_FILENO);
+	signal(SIGPIPE, SIG_DFL);
+	execl(path, path, (char *)NULL);
+	unix_error(path);
+    }
+    close(in[0]);
+    close(out[1]);
+    sh.in = in[1];
+    sh.out = out[0];
+}
+
+/* send - Send a command line to the shell */
+void send(const char *fmt, ...)
+{
+    char line[256];
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(line, sizeof(line) - 1, fmt, ap);
+    va_end(ap);
+    line[n++] = '\n';
+    if (write(sh.in, line, n) != n)
+	unix_error("write to shell");
+    sh.sent++;
+}
+
+/*
+ * pump - Read what the shell has written, waiting at most ms, and count
+ *    its prompts. Output before the last prompt is dropped unless keep
+ *    is set. Returns 0 if the shell has exited.
+ */
+int pump(int ms, int keep)
+{
+    struct pollfd pfd;
+    char *p, *last = NULL;
+    ssize_t n;
+
+    pfd.fd = sh.out;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, ms) <= 0)
+	return 1;
+    if (sh.len + 65536 + 1 > sh.cap) {
+	sh.cap = 2 * (sh.len + 65536 + 1);
+	if ((sh.buf = realloc(sh.buf, sh.cap)) == NULL)
+	    unix_error("realloc");
+    }
+    if ((n = read(sh.out, sh.buf + sh.len, 65536)) <= 0)
+	return 0;
+
+    /* a prompt can straddle two reads, so look from 4 bytes back */
+    p = sh.buf + ((sh.len > 4) ? sh.len - 4 : 0);
+    sh.len += n;
+    sh.buf[sh.len] = '\0';
+    for (; (p = strstr(p, "tsh> ")) != NULL; p += 5) {
+	sh.prompts++;
+	last = p + 5;
+    }
+    if (last != NULL && !keep) {
+	sh.len -= last - sh.buf;
+	memmove(sh.buf, last, sh.len + 1);
+    }
+    return 1;
+}
+
+/* catchup - Wait until the shell has run every line sent; 0 on timeout */
+int catchup(void)
+{
+    long long deadline = now() + TIMEOUT_MS * 1000000LL;
+
+    while (sh.prompts < sh.sent && now() < deadline)
+	if (!pump(10, 0))
+	    return 0;
+    return sh.prompts >= sh.sent;
+}
+
+/* listjobs - Ask the shell for its jobs and parse them into jobs[] */
+int listjobs(void)
+{
+    long long deadline = now() + TIMEOUT_MS * 1000000LL;
+    char *p, *mark;
+    int jid, pid;
+    char state[16];
+
+    sh.len = 0;
+    send("jobs");
+    send("/bin/echo @@MARK");
+    while ((mark = (sh.buf != NULL) ? strstr(sh.buf, "@@MARK\n") : NULL) == NULL)
+	if (now() >= deadline || !pump(10, 1))
+	    return 0;
+    njobs = 0;
+    for (p = sh.buf; p < mark && njobs < MAXJOBS; p = strchr(p, '\n') + 1) {
+	if (sscanf(p, "[%d] (%d) %15s", &jid, &pid, state) == 3 &&
+	    (strcmp(state, "Running") == 0 || strcmp(state, "Stopped") == 0 ||
+	     strcmp(state, "Foreground") == 0 || strcmp(state, "Queued") == 0)) {
+	    jobs[njobs].jid = jid;
+	    jobs[njobs].pid = pid;
+	    strcpy(jobs[njobs].state, state);
+	    njobs++;
+	}
+	if (strchr(p, '\n') == NULL)
+	    break;
+    }
+    return catchup();
+}
+
+/* check - Pause the storm, and check the job list against /proc */
+void check(int final)
+{
+    static struct procs before, after;
+    int i, j;
+    char s;
+
+    nchecks++;
+    if (!catchup()) {
+	violation("the shell stopped reading commands");
+	return;
+    }
+    usleep(SETTLE_MS * 1000);
+    pump(0, 0);
+    scan(&before);
+    if (!listjobs()) {
+	violation("the shell didn't list its jobs");
+	return;
+    }
+    scan(&after);
+
+    for (i = 0; i < njobs; i++) {
+	if (strcmp(jobs[i].state, "Foreground") == 0)
+	    violation("job [%d] (%d) is in the foreground at the prompt", jobs[i].jid, jobs[i].pid);
+	if (strcmp(jobs[i].state, "Queued") != 0 && findproc(&before, jobs[i].pid) == 0)
+	    violation("job [%d] (%d) is not a child of the shell", jobs[i].jid, jobs[i].pid);
+	if (strcmp(jobs[i].state, "Running") == 0 && findproc(&before, jobs[i].pid) == 'T' &&
+	    findproc(&after, jobs[i].pid) == 'T')
+	    violation("job [%d] (%d) is listed as Running but is stopped", jobs[i].jid, jobs[i].pid);
+	for (j = 0; j < i; j++)
+	    if (jobs[j].pid == jobs[i].pid)
+		violation("jobs [%d] and [%d] are both PID %d", jobs[j].jid, jobs[i].jid, jobs[i].pid);
+    }
+    for (i = 0; i < after.n; i++) {
+	if ((s = findproc(&before, after.p[i].pid)) == 0)
+	    continue;
+	if (s == 'Z' && after.p[i].state == 'Z')
+	    violation("child %d is a zombie that wasn't reaped", after.p[i].pid);
+	if (s != 'Z' && after.p[i].state != 'Z') {
+	    for (j = 0; j < njobs && jobs[j].pid != after.p[i].pid; j++)
+		;
+	    if (j == njobs)
+		violation("child %d is not a job", after.p[i].pid);
+	}
+    }
+    if (final && njobs > 0)
+	violation("%d jobs are left after all the children were killed", njobs);
+}
+
+/* command - Send the shell a random command */
+void command(int maxbg)
+{
+    int r = random() % 100;
+
+    if (njobs > 0 && r < 5)
+	send("fg %%%d", jobs[random() % njobs].jid);
+    else if (njobs > 0 && r < 15)
+	send("bg %%%d", jobs[random() % njobs].jid);
+    else if (r < 55 || kids.n >= maxbg)
+	send("%s -t %ld", workload, 1 + random() % 30);
+    else if (r < 60)
+	send("%s -t %ld -f 2x2 &", workload, 10 + random() % 200);
+    else
+	send("%s -t %ld &", workload, 10 + random() % 500);
+    ncommands++;
+}
+
+/* storm - Send a random signal to the shell or to a child's process group */
+void storm(void)
+{
+    static const int shellsigs[] = {SIGTSTP, SIGINT, SIGCONT};
+    static const int kidsigs[] = {SIGTSTP, SIGTSTP, SIGINT, SIGCONT, SIGCONT, SIGKILL};
+
+    if (kids.n == 0 || random() % 10 < 3)
+	kill(sh.pid, shellsigs[random() % 3]);
+    else
+	kill(-kids.p[random() % kids.n].pid, kidsigs[random() % 6]);
+    nsignals++;
+}
+
+int main(int argc, char **argv)
+{
+    char *shell = "./tsh";
+    int secs = 10, rate = 2000, maxbg = 200, c, i;
+    unsigned int seed = time(NULL);
+    long long end, t, nextsig, nextcheck, nextscan, wake;
+    struct timespec ts;
+    struct pollfd pfd;
+
+    while ((c = getopt(argc, argv, "hd:r:j:S:s:w:")) != EOF) {
+	switch (c) {
+	case 'd':
+	    secs = atoi(optarg);
+	    break;
+	case 'r':
+	    rate = atoi(optarg);
+	    break;
+	case 'j':
+	    maxbg = atoi(optarg);
+	    break;
+	case 'S':
+	    seed = strtoul(optarg, NULL, 0);
+	    break;
+	case 's':
+	    shell = optarg;
+	    break;
+	case 'w':
+	    workload = optarg;
+	    break;
+	default:
+	    usage();
+	}
+    }
+    if (rate <= 0)
+	usage();
+    printf("stormtest: %s for %d s, %d signals/sec, seed %u\n", shell, secs, rate, seed);
+    fflush(stdout);
+    srandom(seed);
+    signal(SIGPIPE, SIG_IGN);
+    unsetenv("TSH_HISTFILE");
+
+    startshell(shell);
+    sh.sent = 1;                /* the first prompt comes unasked */
+    if (!catchup()) {
+	fprintf(stderr, "stormtest: %s: no prompt\n", shell);
+	exit(1);
+    }
+
+    start = now();
+    end = start + secs * 1000000000LL;
+    nextsig = nextcheck = nextscan = start;
+    while ((t = now()) < end) {
+	if (!pump(0, 0)) {
+	    violation("the shell exited");
+	    break;
+	}
+	if (t >= nextcheck) {
+	    check(0);
+	    nextcheck = now() + CHECK_MS * 1000000LL;
+	    nextsig = nextscan = now();
+	    continue;
+	}
+	if (t >= nextscan) {
+	    scan(&kids);
+	    nextscan = t + SCAN_MS * 1000000LL;
+	}
+	if (sh.sent - sh.prompts < MAXPENDING)
+	    command(maxbg);
+	if (t >= nextsig) {
+	    storm();
+	    nextsig += 1000000000LL / rate;
+	    continue;
+	}
+
+	/* sleep until the next signal is due or the shell writes */
+	wake = (nextsig < nextscan) ? nextsig : nextscan;
+	pfd.fd = sh.out;
+	pfd.events = POLLIN;
+	ts.tv_sec = (wake - t) / 1000000000LL;
+	ts.tv_nsec = (wake - t) % 1000000000LL;
+	ppoll(&pfd, 1, &ts, NULL);
+    }
+    t = now();
+
+    /* kill everything, give the shell time to reap it, and check once more */
+    catchup();
+    scan(&kids);
+    for (i = 0; i < kids.n; i++) {
+	kill(-kids.p[i].pid, SIGKILL);
+	kill(kids.p[i].pid, SIGKILL);
+    }
+    usleep(200000);
+    check(1);
+
+    close(sh.in);
+    waitpid(sh.pid, NULL, 0);
+    printf("stormtest: %.1f s, %ld commands, %ld signals, %.0f events/sec, %ld checks, %ld violations\n",
+	   (t - start) / 1e9, ncommands, nsignals, (ncommands + nsignals) / ((t - start) / 1e9),
+	   nchecks, nviolations);
+    exit(nviolations > 0);
+}
@@ -0,0 +1,516 @@
+/*
+ * tdriver.c - Trace-driven shell driver
+ *
+ * usage: tdriver [-hvg] -t <trace> -s <shell> [-a <args>]
+ *        tdriver [-v] -c [-s <shell>] [-r <refshell>] [-a <args>] <trace>...
+ *
+ * Runs a shell as a child, sends it the commands and signals a trace
+ * file asks for, and prints the trace's comments followed by the
+ * shell's output, like sdriver.pl. Besides sdriver.pl's driver commands
+ * (TSTP, INT, QUIT, KILL, CLOSE, WAIT and SLEEP <n>) a trace may use
+ *     SLEEP_MS <n>     Sleep for <n> milliseconds
+ *     WAITFOR <regex>  Wait until the shell's output since the last
+ *                      WAITFOR matches <regex> (POSIX extended), for
+ *                      at most 10 seconds
+ * The output is read while the trace runs, so a WAITFOR can take the
+ * place of a SLEEP that only gives the shell time to catch up.
+ *
+ * With -c, all the traces are run at once against both shells (default
+ * ./tsh and ./tshref), and each pair of outputs is compared after PIDs
+ * are replaced by "PID". Each run gets a session and terminal of its
+ * own, and /bin/ps listings are reduced to the mysplit processes on that
+ * terminal and their states, the only part that is the same from run to
+ * run. Differences are shown with diff -u; the exit status is 1 if
+ * there are any.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <regex.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define WAITFOR_MS 10000    /* longest a WAITFOR waits */
+#define MAXSHELLARGS  64    /* words in the shell's -a arguments */
+#define MAXTRACES    256    /* traces run by -c */
+
+struct buf {                /* A growable, NUL-terminated byte buffer */
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+struct run {                /* One trace run by one shell (-c) */
+    char *trace;            /* trace file */
+    char *shell;            /* shell program */
+    pid_t pid;              /* process running it */
+    FILE *fp;               /* its normalized output */
+    double secs;            /* how long it took */
+};
+
+int verbose = 0;            /* print what the driver does */
+
+void usage(char *msg)
+{
+    if (msg != NULL)
+	fprintf(stderr, "%s\n", msg);
+    fprintf(stderr, "Usage: tdriver [-hvg] -t <trace> -s <shellprog> -a <args>\n");
+    fprintf(stderr, "       tdriver [-v] -c [-s <shell>] [-r <refshell>] [-a <args>] <trace>...\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -h            Print this message\n");
+    fprintf(stderr, "  -v            Be more verbose\n");
+    fprintf(stderr, "  -t <trace>    Trace file\n");
+    fprintf(stderr, "  -s <shell>    Shell program to test\n");
+    fprintf(stderr, "  -a <args>     Shell arguments\n");
+    fprintf(stderr, "  -g            Generate output for autograder\n");
+    fprintf(stderr, "  -c            Compare <shell> and <refshell> on all traces, in parallel\n");
+    fprintf(stderr, "  -r <refshell> Reference shell for -c (default ./tshref)\n");
+    exit(1);
+}
+
+void unix_error(char *msg)
+{
+    fprintf(stderr, "tdriver: %s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+/* append - Append n bytes of s to b */
+void append(struct buf *b, const char *s, size_t n)
+{
+    if (b->len + n + 1 > b->cap) {
+	b->cap = 2 * (b->len + n + 1);
+	if ((b->data = realloc(b->data, b->cap)) == NULL)
+	    unix_error("realloc");
+    }
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
+    b->data[b->len] = '\0';
+}
+
+/* bprintf - Append formatted text to b */
+void bprintf(struct buf *b, const char *fmt, ...)
+{
+    char line[1024];
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    append(b, line, (n < (int)sizeof(line)) ? n : sizeof(line) - 1);
+}
+
+/* now - Milliseconds on the monotonic clock */
+long long now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/*
+ * pump - Read the shell's output from fd into out until deadline (ms),
+ *    or only what is there if deadline is 0. Returns 0 at end of file.
+ */
+int pump(int fd, struct buf *out, long long deadline)
+{
+    char chunk[4096];
+    struct pollfd pfd;
+    long long left;
+    ssize_t n;
+
+    do {
+	left = deadline ? deadline - now() : 0;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, (left > 0) ? (int)left : 0) < 0 && errno != EINTR)
+	    unix_error("poll");
+	if (pfd.revents) {
+	    if ((n = read(fd, chunk, sizeof(chunk))) == 0)
+		return 0;
+	    if (n > 0)
+		append(out, chunk, n);
+	}
+    } while (left > 0);
+    return 1;
+}
+
+/*
+ * runtrace - Run shell (with the blank-separated args) on trace and
+ *    leave the comments and then the output in out. If tty is not NULL,
+ *    the shell gets a session and a new terminal, whose name (as ps
+ *    shows it) is copied to tty.
+ */
+void runtrace(char *trace, char *shell, char *args, int grade, struct buf *out, char *tty)
+{
+    static char *sigs[] = {"TSTP", "INT", "QUIT", "KILL", NULL};
+    static int signos[] = {SIGTSTP, SIGINT, SIGQUIT, SIGKILL};
+    struct buf output = {NULL, 0, 0};   /* the shell's output */
+    char *argv[MAXSHELLARGS + 2], *argbuf, *line = NULL, *cmd, *arg;
+    int in[2], outp[2], master = -1, status, i, writing = 1, reaped = 0;
+    size_t linecap = 0, mark = 0, len;
+    long long deadline;
+    regmatch_t m;
+    regex_t re;
+    ssize_t n;
+    pid_t pid;
+    FILE *fp;
+
+    if ((fp = fopen(trace, "r")) == NULL)
+	unix_error(trace);
+    argv[0] = shell;
+    argbuf = strdup(args ? args : "");
+    for (i = 1, arg = strtok(argbuf, " \t"); arg != NULL && i <= MAXSHELLARGS; arg = strtok(NULL, " \t"))
+	argv[i++] = arg;
+    argv[i] = NULL;
+
+    if (pipe2(in, O_CLOEXEC) < 0 || pipe2(outp, O_CLOEXEC) < 0)
+	unix_error("pipe");
+    if (tty != NULL) {
+	if ((master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC)) < 0 ||
+	    grantpt(master) < 0 || unlockpt(master) < 0)
+	    unix_error("posix_openpt");
+	strcpy(tty, ptsname(master) + strlen("/dev/"));
+    }
+    if ((pid = fork()) < 0)
+	unix_error("fork");
+    if (pid == 0) {
+	if (tty != NULL) {
+	    setsid();
+	    if ((i = open(ptsname(master), O_RDWR)) >= 0)  /* becomes our terminal */
+		close(i);
+	}
+	dup2(in[0], STDIN_FILENO);
+	dup2(outp[1], STDOUT_FILENO);
+	signal(SIGPIPE, SIG_DFL);
+	execv(shell, argv);
+	fprintf(stderr, "tdriver: %s: %s\n", shell, strerror(errno));
+	_exit(127);
+    }
+    close(in[0]);
+    close(outp[1]);
+    if (grade)
+	bprintf(out, "pid=%d\n", (int)pid);
+
+    while ((n = getline(&line, &linecap, fp)) >= 0) {
+	if (n > 0 && line[n - 1] == '\n')
+	    line[--n] = '\0';
+	pump(outp[0], &output, 0);
+
+	/* Comment line */
+	if (line[0] == '#') {
+	    bprintf(out, "%s\n", line);
+	    continue;
+	}
+
+	/* Blank line */
+	cmd = line + strspn(line, " \t");
+	if (*cmd == '\0') {
+	    if (verbose)
+		bprintf(out, "tdriver: Ignoring blank line\n");
+	    continue;
+	}
+	arg = cmd + strcspn(cmd, " \t");
+	len = arg - cmd;
+	arg += strspn(arg, " \t");
+
+	/* Send a signal */
+	for (i = 0; sigs[i] != NULL; i++)
+	    if (len == strlen(sigs[i]) && strncmp(cmd, sigs[i], len) == 0)
+		break;
+	if (sigs[i] != NULL) {
+	    if (verbose)
+		bprintf(out, "tdriver: Sending SIG%s signal to process %d\n", sigs[i], (int)pid);
+	    kill(pid, signos[i]);
+	}
+
+	/* Close pipe (sends EOF notification to child) */
+	else if (len == 5 && strncmp(cmd, "CLOSE", 5) == 0) {
+	    if (verbose)
+		bprintf(out, "tdriver: Closing output end of pipe to child %d\n", (int)pid);
+	    if (writing)
+		close(in[1]);
+	    writing = 0;
+	}
+
+	/* Wait for child to terminate, reading its output meanwhile */
+	else if (len == 4 && strncmp(cmd, "WAIT", 4) == 0) {
+	    if (verbose)
+		bprintf(out, "tdriver: Waiting for child %d\n", (int)pid);
+	    while (!reaped) {
+		if (waitpid(pid, &status, WNOHANG) == pid)
+		    reaped = 1;
+		else if (!pump(outp[0], &output, now() + 10))
+		    usleep(10000);
+	    }
+	    if (verbose)
+		bprintf(out, "tdriver: Child %d reaped\n", (int)pid);
+	}
+
+	/* Sleep, reading output meanwhile */
+	else if ((len == 5 && strncmp(cmd, "SLEEP", 5) == 0) ||
+		 (len == 8 && strncmp(cmd, "SLEEP_MS", 8) == 0)) {
+	    if (verbose)
+		bprintf(out, "tdriver: Sleeping %s %s\n", arg, (len == 5) ? "secs" : "ms");
+	    deadline = now() + atoll(arg) * ((len == 5) ? 1000 : 1);
+	    if (!pump(outp[0], &output, deadline) && now() < deadline)
+		usleep((deadline - now()) * 1000);
+	}
+
+	/* Wait for the output to match a regular expression */
+	else if (len == 7 && strncmp(cmd, "WAITFOR", 7) == 0) {
+	    if (verbose)
+		bprintf(out, "tdriver: Waiting for output matching %s\n", arg);
+	    if ((i = regcomp(&re, arg, REG_EXTENDED | REG_NEWLINE)) != 0) {
+		bprintf(out, "tdriver: WAITFOR %s: bad regular expression\n", arg);
+		continue;
+	    }
+	    deadline = now() + WAITFOR_MS;
+	    while (regexec(&re, output.data ? output.data + mark : "", 1, &m, 0) != 0) {
+		if (now() >= deadline || !pump(outp[0], &output, now() + 10)) {
+		    bprintf(&output, "tdriver: WAITFOR %s: no match\n", arg);
+		    m.rm_eo = output.len - mark;
+		    break;
+		}
+	    }
+	    mark += m.rm_eo;
+	    regfree(&re);
+	}
+
+	/* Anything else goes to the shell */
+	else {
+	    if (verbose)
+		bprintf(out, "tdriver: Sending :%s: to child %d\n", line, (int)pid);
+	    line[n] = '\n';
+	    if (writing && write(in[1], line, n + 1) < 0 && errno != EPIPE)
+		unix_error("write");
+	}
+    }
+
+    /* Read the rest of the output and reap the shell */
+    if (writing)
+	close(in[1]);
+    if (verbose)
+	bprintf(out, "tdriver: Reading data from child %d\n", (int)pid);
+    while (pump(outp[0], &output, now() + 1000))
+	;
+    close(outp[0]);
+    if (!reaped)
+	waitpid(pid, &status, 0);
+    if (master >= 0)
+	close(master);
+    if (verbose)
+	bprintf(out, "tdriver: Shell terminated\n");
+    if (output.len > 0)
+	append(out, output.data, output.len);
+    free(output.data);
+    free(argbuf);
+    free(line);
+    fclose(fp);
+}
+
+/*
+ * normalize - Write out to fp with PIDs in parentheses replaced by PID,
+ *    and ps listings reduced to the state and command of the mysplit
+ *    processes on terminal tty
+ */
+void normalize(struct buf *out, const char *tty, FILE *fp)
+{
+    regmatch_t m[4];
+    regex_t psrow;
+    char *line, *next, *p;
+
+    regcomp(&psrow, "^ *[0-9]+ +([^ ]+) +([^ ]+) +[0-9]+:[0-9]+ (.*)$", REG_EXTENDED);
+    for (line = out->data; line != NULL && *line != '\0'; line = next) {
+	if ((next = strchr(line, '\n')) != NULL)
+	    *next++ = '\0';
+	if (regexec(&psrow, line, 4, m, 0) == 0) {
+	    if ((int)strlen(tty) == m[1].rm_eo - m[1].rm_so &&
+		strncmp(line + m[1].rm_so, tty, strlen(tty)) == 0 &&
+		strstr(line + m[3].rm_so, "mysplit") != NULL)
+		fprintf(fp, "PID TTY %.*s %s\n",
+			(int)(m[2].rm_eo - m[2].rm_so), line + m[2].rm_so, line + m[3].rm_so);
+	    continue;
+	}
+	for (p = line; *p != '\0'; p++) {
+	    if (*p == '(' && p[1] >= '0' && p[1] <= '9' &&
+		p[1 + strspn(p + 1, "0123456789")] == ')') {
+		fputs("(PID)", fp);
+		p += 1 + strspn(p + 1, "0123456789");
+	    }
+	    else
+		fputc(*p, fp);
+	}
+	fputc('\n', fp);
+    }
+    regfree(&psrow);
+}
+
+/* slurp - Read the rest of fp (from the start) into b */
+void slurp(FILE *fp, struct buf *b)
+{
+    char chunk[4096];
+    size_t n;
+
+    rewind(fp);
+    b->len = 0;
+    append(b, "", 0);
+    while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+	append(b, chunk, n);
+}
+
+/* showdiff - Print diff -u of the outputs of runs a and b */
+void showdiff(struct run *a, struct run *b)
+{
+    char la[512], lb[512];
+    char pa[] = "/tmp/tdriverXXXXXX", pb[] = "/tmp/tdriverXXXXXX";
+    struct buf data = {NULL, 0, 0};
+    int fa, fb;
+    pid_t pid;
+
+    if ((fa = mkstemp(pa)) < 0 || (fb = mkstemp(pb)) < 0)
+	unix_error("mkstemp");
+    slurp(a->fp, &data);
+    if (write(fa, data.data, data.len) < 0)
+	unix_error(pa);
+    slurp(b->fp, &data);
+    if (write(fb, data.data, data.len) < 0)
+	unix_error(pb);
+    close(fa);
+    close(fb);
+    snprintf(la, sizeof(la), "%s %s", a->trace, a->shell);
+    snprintf(lb, sizeof(lb), "%s %s", b->trace, b->shell);
+    fflush(stdout);
+    if ((pid = fork()) == 0) {
+	execlp("diff", "diff", "-u", "--label", la, "--label", lb, pa, pb, (char *)NULL);
+	_exit(127);
+    }
+    waitpid(pid, NULL, 0);
+    unlink(pa);
+    unlink(pb);
+    free(data.data);
+}
+
+/*
+ * compare - Run every trace with shell and refshell at the same time,
+ *    then report which outputs match. Returns the number that don't.
+ */
+int compare(char **traces, int ntraces, char *shell, char *refshell, char *args)
+{
+    struct run runs[2 * MAXTRACES];
+    struct buf out = {NULL, 0, 0}, a = {NULL, 0, 0}, b = {NULL, 0, 0};
+    char tty[64];
+    long long start = now();
+    int i, n = 2 * ntraces, nbad = 0, left;
+    pid_t pid;
+
+    if (ntraces > MAXTRACES)
+	usage("Too many traces");
+    if (access(shell, X_OK) < 0)
+	unix_error(shell);
+    if (access(refshell, X_OK) < 0)
+	unix_error(refshell);
+    fflush(stdout);
+    for (i = 0; i < n; i++) {
+	runs[i].trace = traces[i / 2];
+	runs[i].shell = (i % 2) ? refshell : shell;
+	if ((runs[i].fp = tmpfile()) == NULL)
+	    unix_error("tmpfile");
+	if ((runs[i].pid = fork()) < 0)
+	    unix_error("fork");
+	if (runs[i].pid == 0) {
+	    runtrace(runs[i].trace, runs[i].shell, args, 0, &out, tty);
+	    normalize(&out, tty, runs[i].fp);
+	    fflush(runs[i].fp);
+	    exit(0);
+	}
+    }
+    for (left = n; left > 0 && (pid = wait(NULL)) > 0; ) {
+	for (i = 0; i < n; i++)
+	    if (runs[i].pid == pid) {
+		runs[i].secs = (now() - start) / 1000.0;
+		left--;
+	    }
+    }
+
+    for (i = 0; i < n; i += 2) {
+	slurp(runs[i].fp, &a);
+	slurp(runs[i + 1].fp, &b);
+	if (a.len == b.len && memcmp(a.data, b.data, a.len) == 0)
+	    printf("%s: ok (%.1f s)\n", runs[i].trace,
+		   (runs[i].secs > runs[i + 1].secs) ? runs[i].secs : runs[i + 1].secs);
+	else {
+	    printf("%s: differs\n", runs[i].trace);
+	    showdiff(&runs[i], &runs[i + 1]);
+	    nbad++;
+	}
+	fclose(runs[i].fp);
+	fclose(runs[i + 1].fp);
+    }
+    printf("%d of %d traces match (%.1f s)\n", ntraces - nbad, ntraces, (now() - start) / 1000.0);
+    free(a.data);
+    free(b.data);
+    return nbad;
+}
+
+int main(int argc, char **argv)
+{
+    char *trace = NULL, *shell = NULL, *refshell = "./tshref", *args = NULL;
+    struct buf out = {NULL, 0, 0};
+    int c, grade = 0, all = 0;
+
+    signal(SIGPIPE, SIG_IGN);
+    while ((c = getopt(argc, argv, "hvgct:s:a:r:")) != EOF) {
+	switch (c) {
+	case 'v':
+	    verbose = 1;
+	    break;
+	case 'g':
+	    grade = 1;
+	    break;
+	case 'c':
+	    all = 1;
+	    break;
+	case 't':
+	    trace = optarg;
+	    break;
+	case 's':
+	    shell = optarg;
+	    break;
+	case 'a':
+	    args = optarg;
+	    break;
+	case 'r':
+	    refshell = optarg;
+	    break;
+	default:
+	    usage(NULL);
+	}
+    }
+
+    if (all) {
+	if (optind == argc)
+	    usage("Missing trace files");
+	exit(compare(&argv[optind], argc - optind, shell ? shell : "./tsh", refshell, args) != 0);
+    }
+
+    if (trace == NULL)
+	usage("Missing required -t argument");
+    if (shell == NULL)
+	usage("Missing required -s argument");
+    if (access(shell, X_OK) < 0)
+	unix_error(shell);
+    runtrace(trace, shell, args, grade, &out, NULL);
+    if (out.len > 0)
+	fwrite(out.data, 1, out.len, stdout);
+    exit(0);
+}
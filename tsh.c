@@ -1,4 +1,5 @@
  //tiny shell program with job control
+#define _GNU_SOURCE         /* pipe2 */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -7,19 +8,65 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <spawn.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/inotify.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include <termios.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <limits.h>
 #include <errno.h>
+#include <stdint.h>
 
 /* Misc manifest constants */
-#define MAXLINE    1024   /* max line size */
-#define MAXARGS     128   /* max args on a command line */
-#define MAXJOBS      16   /* max jobs at any point in time */
+#define MAXLINE    1024   /* line size handled without malloc */
+#define MAXARGS     128   /* args on a command line handled without malloc */
+#define MINJOBS      16   /* initial capacity of the job list */
+#define JOBSLAB      64   /* job structs allocated at a time */
+#define POOLCHUNK 65536   /* bytes the cmdline pool reserves at a time */
+#define MINSTR       16   /* smallest cmdline pool block */
+#define NSTRCLASS     7   /* pool block sizes 16, 32, ..., 1024 (MAXLINE) */
 #define MAXJID    1<<16   /* max job ID */
+#define INBUFSIZE 65536   /* bytes read from a pipe or terminal at a time */
+#define MAXNODES     64   /* NUMA nodes @numa= can name */
+#define EVRING      256   /* job events buffered until the next prompt (power of 2) */
+#define HISTTAIL   4096   /* history entries !prefix scans before re-sorting */
+#define LISTMAX     100   /* completions listed at most */
+#define TRACEBUF  65536   /* trace events kept (power of 2); older ones are overwritten */
+
+#define CTRLKEY(c) ((c) & 0x1f) /* the byte typed with ctrl held */
+#define KEY_DELETE 0x100        /* the delete key (other keys are bytes) */
+
+/* Record a job trace event (see traceevent); one branch when tracing is off */
+#define TRACE(ph, what, pid, pgid, jid, sig) \
+    do { if (__builtin_expect(tracing, 0)) traceevent(ph, what, pid, pgid, jid, sig); } while (0)
+#define TRACESHELL(ph, what) TRACE(ph, what, 0, 0, 0, 0)
 
 /* Job states */
 #define UNDEF 0 /* undefined */
 #define FG 1    /* running in foreground */
 #define BG 2    /* running in background */
 #define ST 3    /* stopped */
+#define QU 4    /* queued, waiting for a free slot (see maxrunning) */
+#define NSTATES 5
 
 /* 
  * Jobs states: FG (foreground), BG (background), ST (stopped)
@@ -28,6 +75,8 @@
  *     ST -> FG  : fg command
  *     ST -> BG  : bg command
  *     BG -> FG  : fg command
+ *     QU -> BG  : a BG job ended (FIFO order), or bg command
+ *     QU -> FG  : fg command
  * At most 1 job can be in the FG state.
  */
 
@@ -35,16 +84,272 @@
 extern char **environ;      /* defined in libc */
 char prompt[] = "tsh> ";    /* command line prompt (DO NOT CHANGE) */
 int verbose = 0;            /* if true, print additional output */
-int nextjid = 1;            /* next job ID to allocate */
+int usefork = 0;            /* if true, never launch with posix_spawn */
+int noutils = 0;            /* if true, run echo, test, ... as programs */
+int builtin_status = 0;     /* exit status of the last utility builtin */
 char sbuf[MAXLINE];         /* for composing sprintf messages */
+int sigfd = -1;             /* signalfd for the shell's job-control signals */
+int epfd = -1;              /* epoll instance multiplexing stdin and sigfd */
+sigset_t shell_mask;        /* signals delivered through sigfd */
+sigset_t prev_mask;         /* blocked[] inherited at startup, restored in children */
+pid_t shellpid;             /* PID of the shell (not of a forked builtin) */
+int interrupted = 0;        /* set when ctrl-c is typed */
+int maxrunning = 0;         /* max BG jobs running at once, 0 = no limit */
+int spread = 0;             /* if true, pin BG stages to CPUs round-robin */
+cpu_set_t shellcpus;        /* CPUs the shell may run on, for spread */
+int spreadnext = 0;         /* CPU to consider first for the next BG stage */
+int tracing = 0;            /* if true, record job events in tracebuf */
+char *tracepath = NULL;     /* where to write the trace at exit (-t) */
 
 struct job_t {              /* The job struct */
-    pid_t pid;              /* job PID */
+    pid_t pid;              /* job PID (of the first stage, also the PGID) */
     int jid;                /* job ID [1, 2, ...] */
     int state;              /* UNDEF, BG, FG, or ST */
-    char cmdline[MAXLINE];  /* command line */
+    char *cmdline;          /* command line (in the cmdline pool) */
+    pid_t *pids;            /* PIDs of all pipeline stages, NULL if only one */
+    int nstages;            /* number of pipeline stages */
+    int nlive;              /* number of stages not reaped yet */
+    int termsig;            /* signal that terminated a stage, 0 if none */
+    struct timespec start;  /* when the job was added (CLOCK_MONOTONIC) */
+    struct timespec resumed; /* when the job last started running */
+    long long activens;     /* nanoseconds spent running before resumed */
+    int timed;              /* report times when done (time keyword) */
+    struct rusage ru;       /* resources used by the stages reaped so far */
+    char *cgroup;           /* cgroup v2 directory of the job, NULL if none */
+    int hastmodes;          /* tmodes is set */
+    struct termios tmodes;  /* terminal modes of the job when it stopped */
+    struct job_t *next;     /* next free job struct, or next QU job */
+};
+
+struct strpool_t {          /* Arena of command line strings */
+    char *chunk;            /* unused tail of the current chunk */
+    size_t chunkleft;       /* bytes left in chunk */
+    char *free[NSTRCLASS];  /* freed blocks, one list per size class */
+    size_t inuse;           /* bytes in blocks handed out */
+    size_t reserved;        /* bytes in all chunks */
+    int nstrings;           /* number of strings handed out */
+};
+
+struct pident_t {           /* An entry of the PID hash table */
+    pid_t pid;              /* key: 0 = empty, -1 = deleted */
+    struct job_t *job;      /* job owning pid */
+};
+
+struct joblist_t {          /* The job list */
+    struct job_t **byjid;   /* byjid[jid] = job with that JID, or NULL */
+    int jidcap;             /* number of slots in byjid */
+    int maxjid;             /* largest allocated job ID, 0 if none */
+    int njobs;              /* number of jobs on the list */
+    struct pident_t *bypid; /* open-addressing hash table PID -> job */
+    int pidcap;             /* number of slots in bypid (power of 2) */
+    int pidused;            /* live plus deleted slots in bypid */
+    struct job_t *fg;       /* the FG job, NULL if none */
+    int nstate[NSTATES];    /* number of jobs in each state */
+    struct job_t *qhead;    /* oldest QU job (queue linked by next) */
+    struct job_t *qtail;    /* newest QU job */
+    struct job_t *free;     /* recycled job structs */
+    int nslabs;             /* number of JOBSLAB-sized blocks of job structs */
+    struct strpool_t cmdlines; /* storage for the jobs' command lines */
+};
+struct joblist_t jobs;      /* The job list */
+
+struct args_t {             /* A growable argument list */
+    char **argv;            /* words, NULL-terminated */
+    unsigned char *plain;   /* number of unquoted chars each word starts with (max 255) */
+    int argc;               /* number of words */
+    int cap;                /* slots in argv and plain */
+    int heap;               /* argv and plain were allocated by parseline */
+};
+
+struct redir_t {            /* An I/O redirection of a command */
+    int fd;                 /* descriptor being redirected */
+    int flags;              /* open() flags for path */
+    char *path;             /* file to open, NULL to copy dupfd (fd>&dupfd) */
+    int dupfd;              /* descriptor to copy */
+};
+
+/* Placement flags */
+#define PL_CPUS 1   /* pin to the CPUs in cpus */
+#define PL_CPU  2   /* pin to the single CPU cpu */
+#define PL_NUMA 4   /* bind memory (and, without PL_CPUS, CPUs) to node numa */
+#define PL_NICE 8   /* set the niceness to nice */
+#define PL_CGROUP 16 /* move into the cgroup v2 directory cgroup */
+
+struct placement_t {        /* Where a pipeline stage runs (@ modifiers) */
+    int flags;              /* PL_CPUS, PL_CPU, PL_NUMA, PL_NICE, PL_CGROUP or 0 */
+    char *cpus;             /* @cpus= CPU list, e.g. "0-3,8" */
+    int cpu;                /* CPU picked by spread */
+    int numa;               /* @numa= node */
+    int nice;               /* @nice= niceness */
+    char *cgroup;           /* cgroup of the job */
+};
+
+struct cglimits_t {         /* cgroup v2 limits for BG jobs (the cgroup builtin) */
+    int on;                 /* give each BG job its own cgroup */
+    char *base;             /* directory the job cgroups are made in, NULL until needed */
+    char cpu[32];           /* cpu.max value, "" if unlimited */
+    char mem[32];           /* memory.max value, "" if unlimited */
+    char pids[32];          /* pids.max value, "" if unlimited */
+};
+
+/* Job event types */
+#define EV_STOPPED    1 /* job stopped by sig */
+#define EV_TERMINATED 2 /* job terminated by sig */
+#define EV_REPORT     3 /* finished job's -v and/or time report */
+
+/* Reports of a finished job */
+#define REP_STAT  1 /* resources used, as jobstat prints them (-v) */
+#define REP_TIMES 2 /* real, user and sys times (time keyword) */
+
+struct jobreport_t {        /* What the -v and time reports show (see fillreport) */
+    char *cmdline;          /* job's command line */
+    long long wallns;       /* time since the job was added */
+    long long activens;     /* time spent running (see jobactivens) */
+    struct timeval utime;   /* user CPU time */
+    struct timeval stime;   /* system CPU time */
+    long maxrss;            /* peak RSS, KB */
+    long nvcsw, nivcsw;     /* voluntary and involuntary context switches */
+    int show;               /* REP_STAT and/or REP_TIMES */
+};
+
+struct jobevent_t {         /* A job state change to report */
+    unsigned char type;     /* EV_STOPPED, EV_TERMINATED or EV_REPORT */
+    unsigned char sig;      /* signal that stopped or terminated the job */
+    int jid;                /* job ID */
+    pid_t pid;              /* job PID (PGID) */
+    long long ns;           /* when it was posted (CLOCK_MONOTONIC) */
+    struct jobreport_t rep; /* EV_REPORT only; owns rep.cmdline until printed */
+};
+
+struct evring_t {           /* Single-producer single-consumer ring of job events */
+    struct jobevent_t ev[EVRING];
+    unsigned int head;      /* next slot to fill; written by postevent only */
+    unsigned int tail;      /* next slot to render; written by drainevents only */
+    unsigned long nevents;  /* events rendered */
+    long long maxlat;       /* longest post-to-render latency, ns */
+};
+
+struct traceev_t {          /* A recorded job event (see traceevent) */
+    long long ns;           /* when (CLOCK_MONOTONIC) */
+    const char *what;       /* event name, NULL for the start of a process */
+    pid_t pid;              /* process the event is about, 0 = the shell */
+    pid_t pgid;             /* its job's process group */
+    int jid;                /* its job, 0 if not known yet */
+    char ph;                /* Chrome trace phase: 'B'egin, 'E'nd or 'i'nstant */
+    unsigned char sig;      /* signal that stopped or terminated it */
+    char cmd[18];           /* program started (what == NULL) */
+};
+
+struct tracebuf_t {         /* Ring of trace events, shared with forked children */
+    unsigned long head;     /* events recorded so far */
+    long long start;        /* time 0 of the trace */
+    struct traceev_t ev[TRACEBUF];
+};
+struct tracebuf_t *tracebuf; /* The trace, mapped by starttrace */
+
+struct input_t {            /* The source of command lines */
+    int fd;                 /* descriptor lines are read from */
+    int pollable;           /* fd is in epfd; false for regular files */
+    int mapped;             /* buf is an mmap of the rest of a regular file */
+    char *buf;              /* input bytes */
+    size_t len;             /* number of valid bytes in buf */
+    size_t pos;             /* start of the first line not returned yet */
+    size_t cap;             /* size of buf (unless mapped) */
+    int eof;                /* no more bytes will arrive */
+    char *line;             /* the line returned by readcmdline */
+    size_t linecap;         /* size of line */
+    dev_t dev;              /* device and inode of fd, to recognize it */
+    ino_t ino;              /*   when it is also someone's stdin */
+};
+struct input_t input;       /* The shell's command input */
+struct cglimits_t cglimits; /* The cgroup settings */
+struct evring_t evring;     /* Job events waiting to be printed */
+
+struct history_t {          /* The command history (see inithistory) */
+    int on;                 /* history is kept */
+    int logfd;              /* the log: one command line per line, O_APPEND */
+    int idxfd;              /* the index: log offset of each line, as uint64_t */
+    char *log;              /* mapping of the log */
+    size_t loglen;          /* bytes of the log mapped */
+    uint64_t *idx;          /* mapping of the index */
+    size_t n;               /* number of entries mapped */
+    int *sorted;            /* entries 0..nsorted-1, sorted by text (for !prefix) */
+    int *maxtree;           /* segment tree of the latest entry in ranges of sorted */
+    size_t nsorted;         /* entries in sorted; later ones are scanned */
+    size_t treecap;         /* leaves of maxtree (power of 2) */
+};
+struct history_t hist;      /* The command history */
+
+struct editor_t {           /* The line editor (see initeditor) */
+    int on;                 /* lines from the terminal are edited */
+    struct termios cooked;  /* terminal modes to run commands in */
+    struct termios raw;     /* terminal modes while editing */
+    const char *prompt;     /* printed before the line */
+    char *buf;              /* the line */
+    size_t len;             /* bytes in the line */
+    size_t pos;             /* cursor position */
+    size_t cap;             /* size of buf */
+    size_t cols;            /* terminal width */
+    size_t histpos;         /* history entry shown, hist.n for the new line */
+    char *saved;            /* the new line, while history is shown */
+};
+struct editor_t editor;     /* The line editor */
+
+struct trienode_t {         /* A node of a trie */
+    int child;              /* first child, 0 if none */
+    int next;               /* next sibling (in byte order), 0 if none */
+    int count;              /* names ending in this subtree */
+    unsigned char c;        /* byte leading here from the parent */
+    unsigned char end;      /* a name ends here */
+};
+
+struct trie_t {             /* A trie of names; nodes[0] is the root */
+    struct trienode_t *nodes;
+    int nnodes;             /* nodes used */
+    int cap;                /* nodes allocated */
+};
+
+struct completer_t {        /* Command completion (see startcompleter) */
+    int started;            /* the completer thread is running */
+    pthread_mutex_t lock;   /* protects the fields below it */
+    pthread_cond_t cond;    /* a trie was requested or built */
+    char *pathvar;          /* PATH to build the next trie from */
+    int requested;          /* tries requested */
+    int built;              /* tries built; the latest is trie */
+    struct trie_t *trie;    /* executables in PATH */
+    int inotifyfd;          /* watches the PATH directories (main thread only) */
+    char *watched;          /* PATH being watched (main thread only) */
+};
+struct completer_t comp;    /* The command completer */
+
+struct matches_t {          /* Completions to list */
+    char **v;               /* the names */
+    int n;                  /* number of names */
+    int cap;                /* size of v */
+};
+
+struct pathent_t {          /* A remembered PATH lookup */
+    char *name;             /* command name */
+    char *path;             /* absolute (or PATH-relative) file it resolved to */
+    int hits;               /* number of times the entry was used */
+    struct pathent_t *next; /* next entry in the same bucket */
+};
+
+struct pathcache_t {        /* Cache of PATH lookups (the hash builtin) */
+    struct pathent_t **buckets; /* hash table of entries, chained */
+    int nbuckets;           /* number of buckets (power of 2) */
+    int nentries;           /* number of entries */
+    char *pathvar;          /* value of PATH the entries were resolved with */
+    unsigned long hits;     /* lookups answered from the cache */
+    unsigned long misses;   /* lookups that searched PATH */
+};
+struct pathcache_t pathcache; /* The PATH lookup cache */
+
+struct builtin_t {          /* A built-in command */
+    char *name;             /* command name */
+    void (*fn)(char **argv); /* runs the command */
+    int util;               /* a utility that also exists as a program */
 };
-struct job_t jobs[MAXJOBS]; /* The job list */
 /* End global variables */
 
 
@@ -52,50 +357,138 @@ struct job_t jobs[MAXJOBS]; /* The job list */
 
 /* Here are the functions that you will implement */
 void eval(char *cmdline);
+void evaljob(char *cmdline, struct job_t *queued);
+void evalargs(char *cmdline, struct args_t *args, int bg, struct job_t *queued);
 int builtin_cmd(char **argv);
+struct builtin_t *findbuiltin(char *name);
+void do_quit(char **argv);
+void do_jobs(char **argv);
 void do_bgfg(char **argv);
+void do_hash(char **argv);
+void do_jobstat(char **argv);
+void do_parallel(char **argv);
+void do_maxjobs(char **argv);
+void do_kill(char **argv);
+void do_cgroup(char **argv);
+void do_history(char **argv);
+void do_echo(char **argv);
+void do_true(char **argv);
+void do_false(char **argv);
+void do_test(char **argv);
+void do_printf(char **argv);
+void do_sleep(char **argv);
+void do_trace(char **argv);
 void waitfg(pid_t pid);
+pid_t launchstage(char **argv, struct redir_t *redirs, int nredirs,
+		  int infd, int outfd, pid_t pgid, struct placement_t *place);
 
 void sigchld_handler(int sig);
 void sigtstp_handler(int sig);
 void sigint_handler(int sig);
 
 /* Here are helper routines that we've provided for you */
-int parseline(const char *cmdline, char **argv); 
+int parseline(const char *cmdline, char *buf, struct args_t *args); 
+int parseredirs(char **argv, unsigned char *plain, struct redir_t *redirs);
+int applyredirs(struct redir_t *redirs, int n, int *saved);
+void restorefds(struct redir_t *redirs, int n, int *saved);
+int parsecpus(const char *list, cpu_set_t *set);
+int nodecpus(int node, cpu_set_t *set);
+int parseplacement(char **argv, unsigned char *plain, struct placement_t *place);
+int applyplacement(struct placement_t *place);
+void spreadcpu(struct placement_t *place);
 void sigquit_handler(int sig);
+void postevent(int type, int sig, int jid, pid_t pid, struct jobreport_t *rep);
+void drainevents(void);
+void starttrace(void);
+struct traceev_t *traceevent(int ph, const char *what, pid_t pid, pid_t pgid, int jid, int sig);
+long long tracens(void);
+void tracestart(pid_t pid, pid_t pgid, int jid, const char *cmd, long long ns);
+long dumptrace(const char *path);
+void exittrace(void);
 
 void clearjob(struct job_t *job);
-void initjobs(struct job_t *jobs);
-int maxjid(struct job_t *jobs); 
-int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline);
-int deletejob(struct job_t *jobs, pid_t pid); 
-pid_t fgpid(struct job_t *jobs);
-struct job_t *getjobpid(struct job_t *jobs, pid_t pid);
-struct job_t *getjobjid(struct job_t *jobs, int jid); 
+void initjobs(struct joblist_t *jobs);
+int maxjid(struct joblist_t *jobs); 
+int addjob(struct joblist_t *jobs, pid_t pid, int state, char *cmdline);
+int addjobpid(struct joblist_t *jobs, int jid, pid_t pid);
+int deletejob(struct joblist_t *jobs, pid_t pid); 
+int queuejob(struct joblist_t *jobs, char *cmdline);
+void startjob(struct joblist_t *jobs, struct job_t *job, pid_t pid);
+void unqueuejob(struct joblist_t *jobs, struct job_t *job);
+void canceljob(struct joblist_t *jobs, struct job_t *job);
+void admitjobs(void);
+void setjobstate(struct joblist_t *jobs, struct job_t *job, int state);
+pid_t fgpid(struct joblist_t *jobs);
+struct job_t *getjobpid(struct joblist_t *jobs, pid_t pid);
+struct job_t *getjobjid(struct joblist_t *jobs, int jid); 
 int pid2jid(pid_t pid); 
-void listjobs(struct job_t *jobs);
+void listjobs(struct joblist_t *jobs, int lflag);
+void addrusage(struct rusage *sum, const struct rusage *ru);
+int procrusage(pid_t pid, struct rusage *ru);
+void jobrusage(struct joblist_t *jobs, struct job_t *job, struct rusage *ru);
+void printjobstat(struct joblist_t *jobs, struct job_t *job);
+void fillreport(struct joblist_t *jobs, struct job_t *job, struct jobreport_t *rep);
+void printstat(int jid, pid_t pid, struct jobreport_t *rep);
+long long jobactivens(struct job_t *job);
+void printtimes(long long realns, struct timeval *utime, struct timeval *stime);
+
+char *pool_strdup(struct strpool_t *pool, const char *str);
+void pool_free(struct strpool_t *pool, char *str);
+
+char *findpath(char *name);
+void forgetpath(char *name);
+void clearpaths(void);
+
+char *cgbase(void);
+char *cgcreate(int jid);
+int cgmove(const char *cgroup, pid_t pid);
+void cgremove(char *cgroup);
+void cgcleanup(void);
+
+void inithistory(const char *path);
+void histadd(const char *cmdline);
+void histsync(void);
+char *histline(size_t i, size_t *len);
+char *histexpand(char *cmdline);
+
+void initeditor(int fd);
+void cookedmode(void);
+char *editline(void);
+void startcompleter(void);
+void pathchanged(void);
+void complete(int list);
+
+void initevents(void);
+void initinput(int fd);
+void dispatch_signals(void);
+void wait_signals(void);
+void fillinput(void);
+char *readcmdline(void);
 
 void usage(void);
 void unix_error(char *msg);
 void app_error(char *msg);
-typedef void handler_t(int);
-handler_t *Signal(int signum, handler_t *handler);
+void *Realloc(void *ptr, size_t size);
 
+#ifndef TSH_NO_MAIN             /* parsebench.c supplies its own main */
 /*
  * main - The shell's main routine 
  */
 int main(int argc, char **argv) 
 {
     char c;
-    char cmdline[MAXLINE];
+    char *cmdline;
     int emit_prompt = 1; /* emit prompt (default) */
+    int infd = STDIN_FILENO; /* where command lines come from */
+    char histpath[PATH_MAX]; /* the history log */
+    char *env, *term;
 
     /* Redirect stderr to stdout (so that driver will get all output
      * on the pipe connected to stdout) */
     dup2(1, 2);
 
     /* Parse the command line */
-    while ((c = getopt(argc, argv, "hvp")) != EOF) {
+    while ((c = getopt(argc, argv, "hvpFBf:j:st:")) != EOF) {
         switch (c) {
         case 'h':             /* print help message */
             usage();
@@ -106,54 +499,105 @@ int main(int argc, char **argv)
         case 'p':             /* don't print a prompt */
             emit_prompt = 0;  /* handy for automatic testing */
 	    break;
+        case 'F':             /* always launch with fork/exec */
+            usefork = 1;
+	    break;
+        case 'B':             /* run echo, test, ... as programs */
+            noutils = 1;
+	    break;
+        case 'f':             /* read commands from a script */
+            if ((infd = open(optarg, O_RDONLY | O_CLOEXEC)) < 0)
+                unix_error(optarg);
+            emit_prompt = 0;
+	    break;
+        case 'j':             /* limit the number of running BG jobs */
+            maxrunning = atoi(optarg);
+	    break;
+        case 's':             /* spread BG jobs over the CPUs */
+            if (sched_getaffinity(0, sizeof(shellcpus), &shellcpus) < 0)
+                unix_error("sched_getaffinity error");
+            spread = 1;
+	    break;
+        case 't':             /* trace jobs, write the trace at exit */
+            tracepath = optarg;
+            starttrace();
+            atexit(exittrace);
+	    break;
 	default:
             usage();
 	}
     }
 
-    /* Install the signal handlers */
+    /* Route SIGINT, SIGTSTP, SIGCHLD and SIGQUIT through a signalfd so
+     * the handlers run synchronously from the event loop */
+    shellpid = getpid();
+    initevents();
+    initinput(infd);
+
+    /* Edit lines typed at a terminal that can take escape sequences */
+    if (emit_prompt && isatty(infd) && isatty(STDOUT_FILENO) &&
+	(term = getenv("TERM")) != NULL && strcmp(term, "dumb") != 0)
+	initeditor(infd);
 
-    /* These are the ones you will need to implement */
-    Signal(SIGINT,  sigint_handler);   /* ctrl-c */
-    Signal(SIGTSTP, sigtstp_handler);  /* ctrl-z */
-    Signal(SIGCHLD, sigchld_handler);  /* Terminated or stopped child */
+    /* Keep a history if someone is typing at us, or if asked to */
+    if ((env = getenv("TSH_HISTFILE")) != NULL) {
+	if (env[0] != '\0')
+	    inithistory(env);
+    }
+    else if (isatty(infd) && (env = getenv("HOME")) != NULL) {
+	snprintf(histpath, sizeof(histpath), "%s/.tsh_history", env);
+	inithistory(histpath);
+    }
 
-    /* This one provides a clean way to kill the shell */
-    Signal(SIGQUIT, sigquit_handler); 
+    /* Unless someone is typing at us, buffer output in large blocks; it
+     * is flushed before children are started and before we block */
+    if (!isatty(STDOUT_FILENO) && !isatty(infd))
+	setvbuf(stdout, NULL, _IOFBF, INBUFSIZE);
 
     /* Initialize the job list */
-    initjobs(jobs);
+    initjobs(&jobs);
 
     /* Execute the shell's read/eval loop */
     while (1) {
 
+	/* Report what happened to jobs since the last prompt */
+	drainevents();
+
 	/* Read command line */
 	if (emit_prompt) {
 	    printf("%s", prompt);
 	    fflush(stdout);
 	}
-	if ((fgets(cmdline, MAXLINE, stdin) == NULL) && ferror(stdin))
-	    app_error("fgets error");
-	if (feof(stdin)) { /* End of file (ctrl-d) */
+	TRACESHELL('B', "read");
+	if ((cmdline = readcmdline()) == NULL) { /* End of file (ctrl-d) */
+	    drainevents();
 	    fflush(stdout);
 	    exit(0);
 	}
+	TRACESHELL('E', "read");
+
+	/* Expand !-references and record the line in the history */
+	if ((cmdline = histexpand(cmdline)) == NULL)
+	    continue;
+	histadd(cmdline);
 
 	/* Evaluate the command line */
+	TRACESHELL('B', "eval");
 	eval(cmdline);
-	fflush(stdout);
-	fflush(stdout);
+	TRACESHELL('E', "eval");
     } 
 
     exit(0); /* control never reaches here */
 }
+#endif /* TSH_NO_MAIN */
   
 /* 
  * eval - Evaluate the command line that the user has just typed in
  * 
  * If the user has requested a built-in command (quit, jobs, bg or fg)
- * then execute it immediately. Otherwise, fork a child process and
- * run the job in the context of the child. If the job is running in
+ * then execute it immediately. Otherwise, fork a child process for
+ * each stage of the pipeline (stages are separated by "|") and run
+ * the job in the context of the children. If the job is running in
  * the foreground, wait for it to terminate and then return.  Note:
  * each child process must have a unique process group ID so that our
  * background children don't receive SIGINT (SIGTSTP) from the kernel
@@ -161,189 +605,964 @@ int main(int argc, char **argv)
 */
 void eval(char *cmdline)
 {
-    char *argv[MAXARGS]; 	// list of arguments
-    char buf[MAXLINE]; 		// command line
+    evaljob(cmdline, NULL);
+}
+
+/*
+ * evaljob - Evaluate cmdline; if queued is not NULL, cmdline is that QU
+ *    job's command line and the job is started in place (see admitjobs).
+ */
+void evaljob(char *cmdline, struct job_t *queued)
+{
+    char *smallargv[MAXARGS]; 	// list of arguments of a typical line
+    unsigned char smallplain[MAXARGS]; // unquoted prefix lengths of a typical line
+    char smallbuf[MAXLINE]; 	// words of a typical line
+    struct args_t args;         // list of arguments
+    char *buf; 			// words of the command line
+    size_t len = strlen(cmdline);
+    int bg;                     // bg = 1 when & is the last character (see parseline)
+
+    // the words are stored in buf, which only has to be as long as the line
+    args.argv = smallargv;
+    args.plain = smallplain;
+    args.cap = MAXARGS;
+    args.heap = 0;
+    buf = (len < MAXLINE) ? smallbuf : Realloc(NULL, len + 1);
+    TRACESHELL('B', "parse");
+    bg = parseline(cmdline, buf, &args); // adding child process to the jobs list as BG?
+    TRACESHELL('E', "parse");
+
+    // empty lines are ignored.
+    if (args.argv[0] != NULL) evalargs(cmdline, &args, bg, queued);
+    else if (queued != NULL) canceljob(&jobs, queued);
+
+    if (buf != smallbuf) free(buf);
+    if (args.heap)
+    {
+        free(args.argv);
+        free(args.plain);
+    }
+    return;
+}
+
+/*
+ * evalargs - Run the command line cmdline, already split into words
+ *    (see eval). Scratch space comes from the stack unless the line has
+ *    MAXARGS words or more. Only unquoted words act as operators. A BG
+ *    job that would exceed maxrunning is queued instead (see evaljob).
+ */
+void evalargs(char *cmdline, struct args_t *args, int bg, struct job_t *queued)
+{
+    char **argv = args->argv;   // list of arguments
+    unsigned char *plain = args->plain; // unquoted prefix length of each word
+    int argc = args->argc;      // number of arguments
+    int smallidx[2 * MAXARGS + 1]; // stage[] and rfirst[] of a typical line
+    struct redir_t smallredirs[MAXARGS]; // redirs[] of a typical line
+    struct placement_t smallplace[MAXARGS]; // place[] of a typical line
+    int *stage;                 // index in argv of the first word of each pipeline stage
+    int nstages;                // number of pipeline stages
+    struct redir_t *redirs;     // I/O redirections of all stages
+    int *rfirst;                // redirs[rfirst[i] .. rfirst[i+1]-1] belong to stage i
+    struct placement_t *place;  // where each stage runs
+    struct builtin_t *b;        // builtin of a single-stage line
+    char *cgroup = NULL;        // cgroup of a BG job (see do_cgroup)
+    int saved[10];              // shell descriptors saved around a redirected builtin
+    int n;
     pid_t pid; 			// process ID
+    pid_t pgid;                 // process group of the job (PID of the first stage)
+    int infd;                   // read end of the pipe from the previous stage
+    int pfd[2];                 // pipe to the next stage
     int jid; 			// job ID
-    int bg;                     // bg = 1 when & is the last character (see parseline)
-    sigset_t set; 		// set of blocked signals
+    long long started = 0;      // when the current stage was launched (if tracing)
+    int timed;                  // time keyword given?
+    struct timespec t0, t1;     // when a timed builtin started and ended
+    struct rusage ru0, ru1;     // shell's resource usage around a timed builtin
+    int i;
+
+    // a leading time keyword reports the job's times when it's done
+    timed = (plain[0] >= 4) && (strcmp(argv[0], "time") == 0);
+    if (timed)
+    {
+        argv++;
+        plain++;
+        if (--argc == 0)
+        {
+            memset(&ru0, 0, sizeof(ru0));
+            printtimes(0, &ru0.ru_utime, &ru0.ru_stime);
+            if (queued != NULL) canceljob(&jobs, queued);
+            return;
+        }
+    }
 
     /*
-     * In eval, the parent must intially block SIGCHLD so...
-     * at child process (fork() = 0), SIGCHLD is unblocked before execve so blocked can be inherited.
-     * at parent process (fork() > 0), SIGCHLD is unblocked after addjob() so deletejob() is not prior to addjob().
+     * The job-control signals stay blocked in the shell and are read from
+     * sigfd, so sigchld_handler can't run before addjob() and no masking is
+     * needed around the launch. The child restores prev_mask before execve.
     */
+    // there are at most argc stages and argc redirections
+    if (argc < MAXARGS)
+    {
+        stage = smallidx;
+        redirs = smallredirs;
+        place = smallplace;
+    }
+    else
+    {
+        stage = Realloc(NULL, (2 * argc + 1) * sizeof(int));
+        redirs = Realloc(NULL, argc * sizeof(struct redir_t));
+        place = Realloc(NULL, argc * sizeof(struct placement_t));
+    }
+    rfirst = stage + ((argc < MAXARGS) ? MAXARGS : argc);
 
-    // create an empty signal set 'set' and add signal number (SIGCHLD).
-    sigemptyset(&set); 		// create an empty set
-    sigaddset(&set, SIGCHLD); 	// add signal number to the set
-    strcpy(buf, cmdline); 	// copy the string into buf
-    bg = parseline(buf, argv); 	// adding child process to the jobs list as BG?
-
-    // empty lines are ignored.
-    if (argv[0] == NULL) return;
+    // split argv at each "|" into NULL-terminated argv lists, one per stage
+    nstages = 0;
+    stage[nstages++] = 0;
+    for (i = 0; argv[i] != NULL; i++) {
+        if ((plain[i] >= 1) && (strcmp(argv[i], "|") == 0)) {
+            argv[i] = NULL;
+            stage[nstages++] = i + 1;
+        }
+    }
+    // skip each stage's leading @ modifiers and move its redirections out
+    // of its argv into redirs
+    rfirst[0] = 0;
+    for (i = 0; i < nstages; i++) {
+        if ((n = parseplacement(&argv[stage[i]], &plain[stage[i]], &place[i])) < 0) goto fail;
+        stage[i] += n;
+        if ((n = parseredirs(&argv[stage[i]], &plain[stage[i]], &redirs[rfirst[i]])) < 0) goto fail;
+        rfirst[i + 1] = rfirst[i] + n;
+        if (argv[stage[i]] == NULL) {
+            printf("syntax error near unexpected token `%s'\n", (nstages > 1) ? "|" : "newline");
+            goto fail;
+        }
+    }
 
     // if a built-in command is given, then do as builtin_cmd()
     // if an argument is not a built-in command (Ex: /bin/ls, ./myspin, ...)
-    if (!builtin_cmd(argv))
+    // builtins inside a pipeline run in a child like any other stage.
+    // (a utility in the background runs as a job, in a child, and so does
+    // one with @ modifiers; the other builtins can't take modifiers)
+    if ((nstages == 1) && ((b = findbuiltin(argv[stage[0]])) != NULL) &&
+        !(*b).util && (place[0].flags != 0))
+    {
+        printf("%s: @ modifiers don't apply to shell builtins\n", argv[stage[0]]);
+        goto fail;
+    }
+    if ((nstages == 1) && (b != NULL) && !((bg || (place[0].flags != 0)) && (*b).util))
+    {
+        if (queued != NULL) canceljob(&jobs, queued); // nothing to start
+        // redirect the shell's own descriptors while the builtin runs
+        if (timed)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            getrusage(RUSAGE_SELF, &ru0);
+        }
+        if (applyredirs(redirs, rfirst[1], saved) == 0) builtin_cmd(&argv[stage[0]]);
+        restorefds(redirs, rfirst[1], saved);
+        if (timed)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            getrusage(RUSAGE_SELF, &ru1);
+            timersub(&ru1.ru_utime, &ru0.ru_utime, &ru1.ru_utime);
+            timersub(&ru1.ru_stime, &ru0.ru_stime, &ru1.ru_stime);
+            printtimes((t1.tv_sec - t0.tv_sec) * 1000000000LL + (t1.tv_nsec - t0.tv_nsec),
+                       &ru1.ru_utime, &ru1.ru_stime);
+        }
+        goto done;
+    }
+
+    // with maxrunning BG jobs running, later ones wait their turn in FIFO order
+    if (bg && (queued == NULL) && (maxrunning > 0) &&
+        ((jobs.qhead != NULL) || (jobs.nstate[BG] >= maxrunning)))
+    {
+        jid = queuejob(&jobs, cmdline);
+        printf("[%d] Queued %s", jid, cmdline);
+        goto done;
+    }
+
+    // with cgroup limits on, a BG job's stages move into its own cgroup
+    // before exec. The job will get the next JID (or keeps its own).
+    if (bg && cglimits.on && ((cgroup = cgcreate((queued != NULL) ? (*queued).jid : maxjid(&jobs) + 1)) != NULL))
+    {
+        for (i = 0; i < nstages; i++)
+        {
+            place[i].cgroup = cgroup;
+            place[i].flags |= PL_CGROUP;
+        }
+    }
+
+    // with -s, BG stages without a placement of their own are pinned
+    // round-robin; only jobs that actually start take a CPU
+    if (bg && spread)
+    {
+        for (i = 0; i < nstages; i++)
+            if (!(place[i].flags & (PL_CPUS | PL_NUMA))) spreadcpu(&place[i]);
+    }
+
+    fflush(stdout); // children must not inherit (and flush) buffered output
+
+    // launch one child per stage, connecting stage i's stdout to stage i+1's stdin.
+    // all stages join the process group of the first one so that signals sent
+    // with kill(-pgid) reach the whole pipeline.
+    pgid = 0;
+    infd = -1;
+    for (i = 0; i < nstages; i++)
+    {
+        pfd[0] = pfd[1] = -1;
+        if ((i < nstages - 1) && (pipe2(pfd, O_CLOEXEC) < 0))
+            unix_error("pipe error");
+
+        if (tracing) started = tracens(); // the start must come before the child's exec
+        pid = launchstage(&argv[stage[i]], &redirs[rfirst[i]], rfirst[i + 1] - rfirst[i],
+                          infd, pfd[1], pgid, &place[i]);
+        if (infd >= 0) close(infd);
+        if (pfd[1] >= 0) close(pfd[1]);
+        infd = pfd[0];
+        if (pid == 0) continue; // the stage could not be started
+
+        if (pgid == 0)
+        {
+            pgid = pid;
+            if (queued != NULL) startjob(&jobs, queued, pid); // the QU job keeps its JID
+            else addjob(&jobs, pid, bg ? BG : FG, cmdline); // add pid to the jobs list as BG if bg, FG otherwise. 
+            if (timed) (*getjobpid(&jobs, pid)).timed = 1;
+            (*getjobpid(&jobs, pid)).cgroup = cgroup; // removed by deletejob
+            cgroup = NULL;
+            jid = pid2jid(pid);
+        }
+        else addjobpid(&jobs, jid, pid); // later stages belong to the same job
+        if (tracing) tracestart(pid, pgid, jid, argv[stage[i]], started);
+    }
+    if (pgid == 0) goto fail; // nothing was started
+
+    if (queued != NULL) goto done; // admitjobs or do_bgfg takes it from here
+    if (!bg) {waitfg(pgid);} // Parent process waits until FG process to be finished.
+    else
+    {
+        jid = pid2jid(pgid); // get JID
+        printf("[%d] (%d) %s", jid, pgid, cmdline); // print BG process
+    }
+    goto done;
+
+fail:
+    if (queued != NULL) canceljob(&jobs, queued); // a QU job that can't start is dropped
+    if (cgroup != NULL) cgremove(cgroup); // nothing was started in it
+
+done:
+    if (stage != smallidx)
+    {
+        free(stage);
+        free(redirs);
+        free(place);
+    }
+    return;
+}
+/*
+ * launchstage - Start one pipeline stage in process group pgid (a new
+ *    group if pgid is 0) with stdin/stdout connected to infd/outfd (if
+ *    not -1) and redirs applied. External commands are started with
+ *    posix_spawn, which glibc implements with clone(CLONE_VM|CLONE_VFORK)
+ *    so the cost doesn't grow with the shell's heap. Builtins, which
+ *    must run in a copy of the shell, stages with a placement (which is
+ *    applied in the child before exec) and -F use fork. Returns the PID,
+ *    or 0 after printing an error if the stage could not be started.
+ */
+pid_t launchstage(char **argv, struct redir_t *redirs, int nredirs,
+		  int infd, int outfd, pid_t pgid, struct placement_t *place)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    int smallfds[MAXARGS];      /* files opened for redirs */
+    int *fds = smallfds;
+    int nfds = 0;
+    pid_t pid;
+    char *path = NULL;          /* resolved argv[0], NULL for a builtin */
+    int external = 0;           /* run the program even if there's a builtin */
+    int cgsync[2] = {-1, -1};   /* the child waits on it until it is in its cgroup */
+    char c;
+    int err, i;
+
+    // "command name args" runs the program name, not the builtin utility
+    if ((strcmp(argv[0], "command") == 0) && (argv[1] != NULL))
+    {
+        argv++;
+        external = 1;
+    }
+
+    // look the command up before creating a process, so that a missing
+    // command costs no fork or spawn
+    if ((external || (findbuiltin(argv[0]) == NULL)) && ((path = findpath(argv[0])) == NULL))
+    {
+        printf("%s: Command not found\n", argv[0]);
+        return 0;
+    }
+
+    if (usefork || path == NULL || (place != NULL && place->flags != 0))
     {
-        // 1) block SIGCHLD before forking
-        sigprocmask(SIG_BLOCK, &set, NULL);
-	    
-	// 2) fork to create a child process
+        TRACESHELL('B', "fork");
+        if ((place != NULL) && (place->flags & PL_CGROUP) && (pipe2(cgsync, O_CLOEXEC) < 0))
+            unix_error("pipe error");
 	pid = fork();
 
         // fork error (fork() = -1)
         if (pid < 0)
         {
             unix_error("fork error");
-            return;
         }
         
-	// 3) child process (fork() = 0)
+	// child process (fork() = 0)
         if (pid == 0)
         {
             // setpgid() so future children of this process join the new process group
-            if (setpgid(0,0) < 0) unix_error("setpigd error");
+            if (setpgid(0, pgid) < 0) unix_error("setpigd error");
+
+            // wait until the shell has moved us into the job's cgroup, so
+            // that nothing runs (or forks) outside it
+            if (cgsync[0] >= 0)
+            {
+                close(cgsync[1]);
+                while ((read(cgsync[0], &c, 1) < 0) && (errno == EINTR))
+                    ;
+                close(cgsync[0]);
+            }
 	
-	    // unblock the SIGCHLD before execv for signal inheritance
-            sigprocmask(SIG_UNBLOCK, &set, NULL);
+	    // unblock the job-control signals before execv for signal inheritance
+            sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+
+            // the dup2() copies don't inherit O_CLOEXEC; the originals close on exec
+            if (infd >= 0) dup2(infd, STDIN_FILENO);
+            if (outfd >= 0) dup2(outfd, STDOUT_FILENO);
+            if (applyredirs(redirs, nredirs, NULL) < 0) exit(1);
+            if ((place != NULL) && (applyplacement(place) < 0)) exit(1);
+
+            if ((path == NULL) && builtin_cmd(argv)) exit(builtin_status);
             
-	    // run by execve()
-            if (execvp(argv[0], argv) < 0) // error when there is no such command
+	    // run by execve(); tracebuf is shared, so the parent sees the event
+            TRACE('i', "exec", getpid(), getpgrp(), 0, 0);
+            if (execv(path, argv) < 0) // error when the file can't be executed
             {
-                printf("%s: Command not found\n" , argv[0]);
+                fprintf(stderr, "%s: Command not found\n" , argv[0]);
                 exit(0); // terminate the process
             }
         }
 
-        // 4) parent process (fork() = pid_child)
-        addjob(jobs, pid, bg ? BG : FG, cmdline); // add pid to the jobs list as BG if bg, FG otherwise. 
-        sigprocmask(SIG_UNBLOCK, &set, NULL); // unblock the SIGCHLD after addjob()
-	if (!bg) {waitfg(pid);} // Parent process waits until FG process to be finished.
-        else
+        // parent process (fork() = pid_child)
+        // setpgid() here too, so the group exists before the next stage joins it.
+        // It fails harmlessly if the child already did it and exec'd.
+        setpgid(pid, pgid == 0 ? pid : pgid);
+        // the shell moves the child, so that errors show up here rather than
+        // in the job's output. Without its cgroup the job still runs, just
+        // unlimited. Closing the pipe lets the child go on.
+        if (cgsync[0] >= 0)
         {
-            jid = pid2jid(pid); // get JID
-            printf("[%d] (%d) %s", jid, pid, cmdline); // print BG process
+            close(cgsync[0]);
+            if (cgmove(place->cgroup, pid) < 0)
+                printf("%s: %s\n", place->cgroup, strerror(errno));
+            close(cgsync[1]);
         }
+        TRACESHELL('E', "fork");
+        return pid;
     }
-    return;
+
+    // The files are opened here rather than by spawn file actions so that
+    // errors can name the file. They are moved above the descriptors that
+    // redirections can target (0-9) and are closed again after the spawn.
+    if (nredirs > MAXARGS) fds = Realloc(NULL, nredirs * sizeof(int));
+    posix_spawn_file_actions_init(&actions);
+    if (infd >= 0) posix_spawn_file_actions_adddup2(&actions, infd, STDIN_FILENO);
+    if (outfd >= 0) posix_spawn_file_actions_adddup2(&actions, outfd, STDOUT_FILENO);
+    err = 0;
+    for (i = 0; i < nredirs; i++)
+    {
+        if (redirs[i].path == NULL)
+        {
+            posix_spawn_file_actions_adddup2(&actions, redirs[i].dupfd, redirs[i].fd);
+            continue;
+        }
+        if ((fds[nfds] = open(redirs[i].path, redirs[i].flags | O_CLOEXEC, 0666)) < 0)
+        {
+            printf("%s: %s\n", redirs[i].path, strerror(errno));
+            err = 1;
+            break;
+        }
+        if (fds[nfds] < 10)
+        {
+            int fd = fcntl(fds[nfds], F_DUPFD_CLOEXEC, 10);
+            close(fds[nfds]);
+            fds[nfds] = fd;
+        }
+        posix_spawn_file_actions_adddup2(&actions, fds[nfds++], redirs[i].fd);
+    }
+
+    if (!err)
+    {
+        posix_spawnattr_init(&attr);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK |
+                                 POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_USEVFORK);
+        posix_spawnattr_setpgroup(&attr, pgid);
+        posix_spawnattr_setsigmask(&attr, &prev_mask);    // unblock the job-control signals
+        posix_spawnattr_setsigdefault(&attr, &shell_mask);
+        TRACESHELL('B', "spawn");
+        err = posix_spawn(&pid, path, &actions, &attr, argv, environ);
+        if (err == ENOENT && strchr(argv[0], '/') == NULL)
+        {
+            // the cached file went away; search PATH again
+            forgetpath(argv[0]);
+            if ((path = findpath(argv[0])) != NULL)
+                err = posix_spawn(&pid, path, &actions, &attr, argv, environ);
+        }
+        posix_spawnattr_destroy(&attr);
+        TRACESHELL('E', "spawn");
+        // with CLONE_VFORK, posix_spawn returns once the child has exec'd
+        if (!err) TRACE('i', "exec", pid, (pgid == 0) ? pid : pgid, 0, 0);
+        if (err == ENOENT || err == EACCES || err == ENOEXEC || err == ENOTDIR)
+            printf("%s: Command not found\n", argv[0]);
+        else if (err)
+            printf("%s: %s\n", argv[0], strerror(err));
+    }
+
+    posix_spawn_file_actions_destroy(&actions);
+    for (i = 0; i < nfds; i++) close(fds[i]);
+    if (fds != smallfds) free(fds);
+    return err ? 0 : pid;
+}
+
+/* Character classes of the tokenizer, see scanspecial */
+#define PLAIN   0  /* outside quotes: blanks, quotes and backslash are special */
+#define SQUOTE  1  /* inside '...': only the closing quote is special */
+#define DQUOTE  2  /* inside "...": the closing quote and backslash are special */
+
+/* isspecial - Is c special in the given class? */
+static inline int isspecial(int c, int class)
+{
+    switch (class) {
+    case SQUOTE:
+	return c == '\'';
+    case DQUOTE:
+	return c == '"' || c == '\\';
+    default:
+	return c == ' ' || c == '\t' || c == '\n' || c == '\'' || c == '"' || c == '\\';
+    }
+}
+
+/*
+ * scanspecial - Return the first character in [p, end) that is special
+ *    in class, or end. Long runs are scanned 16 bytes at a time with SSE2.
+ */
+static const char *scanspecial(const char *p, const char *end, int class)
+{
+#ifdef __SSE2__
+    __m128i chunk, hit;
+
+    while (end - p >= 16) {
+	chunk = _mm_loadu_si128((const __m128i *)p);
+	if (class == SQUOTE)
+	    hit = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\''));
+	else {
+	    hit = _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('"')),
+			       _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\')));
+	    if (class == PLAIN)
+		hit = _mm_or_si128(hit, _mm_or_si128(
+			  _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(' ')),
+				       _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\t'))),
+			  _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')),
+				       _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\'')))));
+	}
+	if (_mm_movemask_epi8(hit) != 0)
+	    return p + __builtin_ctz(_mm_movemask_epi8(hit));
+	p += 16;
+    }
+#endif
+    while (p < end && !isspecial((unsigned char)*p, class))
+	p++;
+    return p;
+}
+
+/* pusharg - Append word to args, growing argv on the heap when full */
+static void pusharg(struct args_t *args, char *word)
+{
+    char **old = args->argv;
+    unsigned char *oldplain = args->plain;
+
+    if (args->argc + 1 >= args->cap) {
+	args->argv = Realloc(args->heap ? old : NULL, 2 * args->cap * sizeof(char *));
+	args->plain = Realloc(args->heap ? oldplain : NULL, 2 * args->cap);
+	if (!args->heap) {
+	    memcpy(args->argv, old, args->argc * sizeof(char *));
+	    memcpy(args->plain, oldplain, args->argc);
+	}
+	args->heap = 1;
+	args->cap *= 2;
+    }
+    args->plain[args->argc] = 0;
+    args->argv[args->argc++] = word;
+    args->argv[args->argc] = NULL;
 }
+
 /* 
  * parseline - Parse the command line and build the argv array.
  * 
- * Characters enclosed in single quotes are treated as a single
- * argument.  Return true if the user has requested a BG job, false if
- * the user has requested a FG job.  
+ * Words are separated by blanks. Characters enclosed in single quotes
+ * are taken literally; in double quotes, a backslash escapes " \ $ and `.
+ * Outside quotes, a backslash escapes a blank, quote, backslash, or one
+ * of | & < >, and is kept otherwise (so "\046" reaches echo -e intact).
+ * Quoted parts join the surrounding word. args->plain records how many
+ * unquoted characters each word starts with, so that e.g. '|' and \>
+ * are ordinary arguments rather than operators.
+ *
+ * The line is read once and the words are written to buf, which must
+ * hold strlen(cmdline)+1 bytes. args->argv starts out with args->cap
+ * slots and is moved to the heap (args->heap) if more are needed.
+ * Return true if the user has requested a BG job, false if the user
+ * has requested a FG job.  
  */
-int parseline(const char *cmdline, char **argv) 
+int parseline(const char *cmdline, char *buf, struct args_t *args) 
 {
-    static char array[MAXLINE]; /* holds local copy of command line */
-    char *buf = array;          /* ptr that traverses command line */
-    char *delim;                /* points to first space delimiter */
-    int argc;                   /* number of args */
+    const char *p = cmdline;    /* ptr that traverses command line */
+    const char *end = cmdline + strlen(cmdline);
+    const char *q;              /* end of a run of ordinary characters */
+    char *out = buf;            /* where the next character of a word goes */
+    int inword = 0;             /* are we inside a word? */
+    int quoted = 0;             /* has the current word had quoted characters? */
     int bg;                     /* background job? */
 
-    strcpy(buf, cmdline);
-    buf[strlen(buf)-1] = ' ';  /* replace trailing '\n' with space */
-    while (*buf && (*buf == ' ')) /* ignore leading spaces */
-	buf++;
-
-    /* Build the argv list */
-    argc = 0;
-    if (*buf == '\'') {
-	buf++;
-	delim = strchr(buf, '\'');
-    }
-    else {
-	delim = strchr(buf, ' ');
-    }
+    args->argc = 0;
+    args->argv[0] = NULL;
+    while (p < end) {
+	/* Copy a run of ordinary characters */
+	q = scanspecial(p, end, PLAIN);
+	if (q > p) {
+	    if (!inword) {
+		pusharg(args, out);
+		inword = 1;
+		quoted = 0;
+	    }
+	    if (!quoted)
+		args->plain[args->argc-1] = (q - p >= 255) ? 255 : q - p;
+	    memcpy(out, p, q - p);
+	    out += q - p;
+	    p = q;
+	    if (p == end)
+		break;
+	}
 
-    while (delim) {
-	argv[argc++] = buf;
-	*delim = '\0';
-	buf = delim + 1;
-	while (*buf && (*buf == ' ')) /* ignore spaces */
-	       buf++;
+	/* A blank ends the current word */
+	if (*p == ' ' || *p == '\t' || *p == '\n') {
+	    if (inword) {
+		*out++ = '\0';
+		inword = 0;
+	    }
+	    p++;
+	    continue;
+	}
 
-	if (*buf == '\'') {
-	    buf++;
-	    delim = strchr(buf, '\'');
+	/* A quote or backslash starts or continues a word */
+	if (!inword) {
+	    pusharg(args, out);
+	    inword = 1;
+	}
+	quoted = 1;
+	if (*p == '\'') {
+	    q = scanspecial(++p, end, SQUOTE);
+	    memcpy(out, p, q - p);
+	    out += q - p;
+	    p = (q < end) ? q + 1 : end;  /* a missing ' ends at the end of line */
+	}
+	else if (*p == '"') {
+	    p++;
+	    while (p < end) {
+		q = scanspecial(p, end, DQUOTE);
+		memcpy(out, p, q - p);
+		out += q - p;
+		p = q;
+		if (p == end)
+		    break;
+		if (*p == '"') {
+		    p++;
+		    break;
+		}
+		if (p + 1 < end && strchr("\"\\$`", p[1]) != NULL)
+		    p++;
+		*out++ = *p++;
+	    }
 	}
 	else {
-	    delim = strchr(buf, ' ');
+	    if (p + 1 < end && strchr(" \t'\"\\|&<>", p[1]) != NULL)
+		p++;
+	    *out++ = *p++;
 	}
     }
-    argv[argc] = NULL;
+    if (inword)
+	*out = '\0';
     
-    if (argc == 0)  /* ignore blank line */
+    if (args->argc == 0)  /* ignore blank line */
 	return 1;
 
     /* should the job run in the background? */
-    if ((bg = (*argv[argc-1] == '&')) != 0) {
-	argv[--argc] = NULL;
+    if ((bg = (*args->argv[args->argc-1] == '&') && (args->plain[args->argc-1] >= 1)) != 0) {
+	args->argv[--args->argc] = NULL;
     }
     return bg;
 }
 
-/* 
- * builtin_cmd - If the user has typed a built-in command then execute
- *    it immediately.  
+/*
+ * parseredirs - Remove the I/O redirections from a command's argv and
+ *    store them in redirs, in order. A redirection is a word starting
+ *    with [n]<, [n]>, or [n]>> followed by a file name (in the same or
+ *    the next word), or [n]>&m. Words that merely contain > or <
+ *    (e.g. "tsh>") are ordinary arguments, and so are words whose
+ *    operator is quoted (plain, see parseline). Returns the number of
+ *    redirections, or -1 after printing an error.
  */
-int builtin_cmd(char **argv)
+int parseredirs(char **argv, unsigned char *plain, struct redir_t *redirs)
 {
-    // Built-in commands include: quit, jobs, bg, fg
-    char *arg1 = argv[0];
-    if (strcmp(arg1, "quit") == 0) {
-        exit(0); // exit from the shell.
-    }
-    else {
-        if (strcmp(arg1, "&") == 0) {
-            return 1; // ignore singleton.
-        }
-        else if (strcmp(arg1, "jobs") == 0) {
-            listjobs(jobs); // show the list of running commands.
-            return 1;
-        }
-        else if (strcmp(arg1, "bg") == 0) {
-            do_bgfg(argv); // change job/process into BG.
-            return 1;
-        }
-        else if (strcmp(arg1, "fg") == 0) {
-            do_bgfg(argv); // change job/process into FG.
-            return 1;
-        }
+    int i, j, n = 0;
+    char *p;
+    struct redir_t *r;
+
+    for (i = j = 0; argv[i] != NULL; i++) {
+	p = argv[i];
+	r = &redirs[n];
+	r->fd = -1;
+	if (isdigit((unsigned char)p[0]) && (p[1] == '<' || p[1] == '>'))
+	    r->fd = *p++ - '0';
+	if ((p - argv[i]) + ((p[0] == '>' && p[1] == '>') ? 2 : 1) > plain[i])
+	    p = "";             /* the operator is quoted */
+	if (*p == '<') {
+	    if (r->fd < 0) r->fd = STDIN_FILENO;
+	    r->flags = O_RDONLY;
+	    p++;
+	}
+	else if (*p == '>') {
+	    if (r->fd < 0) r->fd = STDOUT_FILENO;
+	    r->flags = O_WRONLY | O_CREAT | O_TRUNC;
+	    if (*++p == '>') {
+		r->flags = O_WRONLY | O_CREAT | O_APPEND;
+		p++;
+	    }
+	}
+	else {
+	    plain[j] = plain[i];
+	    argv[j++] = argv[i]; /* an ordinary argument */
+	    continue;
+	}
+
+	r->path = NULL;
+	if (p[0] == '&' && isdigit((unsigned char)p[1]) && p[2] == '\0')
+	    r->dupfd = p[1] - '0';
+	else if (*p != '\0')
+	    r->path = p;
+	else if (argv[i + 1] != NULL)
+	    r->path = argv[++i];
+	else {
+	    printf("syntax error near unexpected token `newline'\n");
+	    return -1;
+	}
+	n++;
     }
-    return 0;     /* not a builtin command */
+    argv[j] = NULL;
+    return n;
 }
 
-/* 
- * do_bgfg - Execute the builtin bg and fg commands
+/*
+ * applyredirs - Perform n redirections in order. If saved is not NULL,
+ *    the previous descriptors are first copied aside (close-on-exec) so
+ *    that restorefds can undo the redirections in the shell. Returns -1
+ *    after printing an error if a file can't be opened.
  */
-void do_bgfg(char **argv)
-/* due to parseline, argv[k] are words separated by space
- * Ex) fg %1
- * argv[0] = arg1 = 'fg'
- * argv[1] = arg2 = %1
- * arg2[0] = '%' // thus we can know that arg2 refers to JID
-*/ 
+int applyredirs(struct redir_t *redirs, int n, int *saved)
 {
-    struct job_t *do_job; // job for do_bgfg
-    char *arg1 = argv[0]; // 1st argument
-    char *arg2 = argv[1]; // 2nd argument
+    int i, fd;
 
-    // Check is arg2 isn't missing
-    if (arg2 == NULL)
-    {
-	printf("%s command requires PID or %%jobid argument\n", arg1);
-	return;
+    if (saved != NULL) {
+	fflush(stdout);
+	for (i = 0; i < n; i++)
+	    saved[redirs[i].fd] = -2; /* not saved yet */
+	for (i = 0; i < n; i++)
+	    if (saved[redirs[i].fd] == -2)
+		saved[redirs[i].fd] = fcntl(redirs[i].fd, F_DUPFD_CLOEXEC, 10);
     }
 
-    int isJID = (arg2[0] == '%'); // JID starts with %
-    int isPID = ((arg2[0] >= 0x30) && (arg2[0] <= 0x39)); // PID starts with integer
-    
-    int i = 1;
-    while(arg2[i] > 0x20) // checks all characters in the arg2, breaks when <space> is present.
+    for (i = 0; i < n; i++) {
+	if (redirs[i].path == NULL) {
+	    if (dup2(redirs[i].dupfd, redirs[i].fd) < 0) {
+		printf("%d: %s\n", redirs[i].dupfd, strerror(errno));
+		return -1;
+	    }
+	    continue;
+	}
+	if ((fd = open(redirs[i].path, redirs[i].flags | O_CLOEXEC, 0666)) < 0) {
+	    printf("%s: %s\n", redirs[i].path, strerror(errno));
+	    return -1;
+	}
+	if (fd != redirs[i].fd) {
+	    dup2(fd, redirs[i].fd); /* the copy is not close-on-exec */
+	    close(fd);
+	}
+	else
+	    fcntl(fd, F_SETFD, 0);
+    }
+    return 0;
+}
+
+/* restorefds - Undo applyredirs in the shell, using the saved descriptors */
+void restorefds(struct redir_t *redirs, int n, int *saved)
+{
+    int i, fd;
+
+    fflush(stdout);
+    for (i = 0; i < n; i++) {
+	fd = redirs[i].fd;
+	if (saved[fd] == -2)
+	    continue; /* already restored */
+	if (saved[fd] >= 0) {
+	    dup2(saved[fd], fd);
+	    close(saved[fd]);
+	}
+	else
+	    close(fd); /* was not open before */
+	saved[fd] = -2;
+    }
+}
+
+/* parsecpus - Parse a CPU list such as "0-3,8" into set; -1 if malformed */
+int parsecpus(const char *list, cpu_set_t *set)
+{
+    char *end;
+    long lo, hi;
+
+    CPU_ZERO(set);
+    do {
+	if (!isdigit((unsigned char)*list))
+	    return -1;
+	lo = hi = strtol(list, &end, 10);
+	if (*end == '-') {
+	    if (!isdigit((unsigned char)end[1]))
+		return -1;
+	    hi = strtol(end + 1, &end, 10);
+	}
+	if (hi < lo || hi >= CPU_SETSIZE)
+	    return -1;
+	for (; lo <= hi; lo++)
+	    CPU_SET(lo, set);
+	list = end;
+    } while (*list++ == ',');
+    return (list[-1] == '\0' || list[-1] == '\n') ? 0 : -1;
+}
+
+/* nodecpus - The CPUs of NUMA node node; -1 if there is no such node */
+int nodecpus(int node, cpu_set_t *set)
+{
+    char path[64], list[1024];
+    FILE *fp;
+    int ok;
+
+    sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+    if ((fp = fopen(path, "r")) == NULL)
+	return -1;
+    ok = (fgets(list, sizeof(list), fp) != NULL) && (parsecpus(list, set) == 0);
+    fclose(fp);
+    return ok ? 0 : -1;
+}
+
+/*
+ * parseplacement - Parse the @cpus=list, @numa=node and @nice=n words at
+ *    the start of a stage's argv into place. Returns the number of words
+ *    used, or -1 after printing an error.
+ */
+int parseplacement(char **argv, unsigned char *plain, struct placement_t *place)
+{
+    cpu_set_t set;
+    char *p, *end;
+    long nice;
+    int i;
+
+    place->flags = 0;
+    for (i = 0; (argv[i] != NULL) && (argv[i][0] == '@') && (plain[i] >= 1); i++) {
+	p = argv[i];
+	if (strncmp(p, "@cpus=", 6) == 0) {
+	    if (parsecpus(p + 6, &set) < 0 || CPU_COUNT(&set) == 0) {
+		printf("%s: invalid CPU list\n", p);
+		return -1;
+	    }
+	    place->cpus = p + 6;
+	    place->flags |= PL_CPUS;
+	}
+	else if (strncmp(p, "@numa=", 6) == 0) {
+	    place->numa = atoi(p + 6);
+	    if (!isdigit((unsigned char)p[6]) || place->numa >= MAXNODES ||
+		nodecpus(place->numa, &set) < 0) {
+		printf("%s: no such NUMA node\n", p);
+		return -1;
+	    }
+	    place->flags |= PL_NUMA;
+	}
+	else if (strncmp(p, "@nice=", 6) == 0) {
+	    errno = 0;
+	    nice = strtol(p + 6, &end, 10);
+	    if (end == p + 6 || *end != '\0' || errno != 0 || nice < -20 || nice > 19) {
+		printf("%s: invalid niceness (use -20 to 19)\n", p);
+		return -1;
+	    }
+	    place->nice = nice;
+	    place->flags |= PL_NICE;
+	}
+	else {
+	    printf("%s: unknown modifier (use @cpus=, @numa= or @nice=)\n", p);
+	    return -1;
+	}
+    }
+    return i;
+}
+
+/*
+ * applyplacement - Apply place to the calling process (a child about to
+ *    exec); launchstage moves it into place->cgroup. Returns -1 after
+ *    printing an error.
+ */
+int applyplacement(struct placement_t *place)
+{
+    cpu_set_t set;
+    unsigned long nodemask;
+
+    CPU_ZERO(&set);
+    if (place->flags & PL_CPUS)
+	parsecpus(place->cpus, &set);
+    else if (place->flags & PL_NUMA)
+	nodecpus(place->numa, &set);
+    else if (place->flags & PL_CPU)
+	CPU_SET(place->cpu, &set);
+    if (CPU_COUNT(&set) > 0 && sched_setaffinity(0, sizeof(set), &set) < 0) {
+	printf("sched_setaffinity: %s\n", strerror(errno));
+	return -1;
+    }
+    if (place->flags & PL_NUMA) {
+	nodemask = 1UL << place->numa;
+	if (syscall(SYS_set_mempolicy, MPOL_BIND, &nodemask, MAXNODES + 1) < 0) {
+	    printf("set_mempolicy: %s\n", strerror(errno));
+	    return -1;
+	}
+    }
+    if ((place->flags & PL_NICE) && setpriority(PRIO_PROCESS, 0, place->nice) < 0) {
+	printf("setpriority: %s\n", strerror(errno));
+	return -1;
+    }
+    return 0;
+}
+
+/* spreadcpu - Pin a BG stage to the next of the shell's CPUs, round-robin */
+void spreadcpu(struct placement_t *place)
+{
+    int i;
+
+    for (i = 0; i < CPU_SETSIZE; i++, spreadnext = (spreadnext + 1) % CPU_SETSIZE)
+	if (CPU_ISSET(spreadnext, &shellcpus))
+	    break;
+    place->cpu = spreadnext;
+    place->flags |= PL_CPU;
+    spreadnext = (spreadnext + 1) % CPU_SETSIZE;
+}
+
+/* The built-in commands, in the order builtin_cmd looks them up */
+struct builtin_t builtins[] = {
+    {"quit", do_quit, 0},  /* exit from the shell */
+    {"jobs", do_jobs, 0},  /* show the list of running commands */
+    {"bg",   do_bgfg, 0},  /* change job/process into BG */
+    {"fg",   do_bgfg, 0},  /* change job/process into FG */
+    {"hash", do_hash, 0},  /* show or reset the PATH lookup cache */
+    {"jobstat", do_jobstat, 0}, /* show the resources used by jobs */
+    {"parallel", do_parallel, 0}, /* run a command once per argument, N at a time */
+    {"maxjobs", do_maxjobs, 0}, /* show or set the limit on running BG jobs */
+    {"cgroup", do_cgroup, 0}, /* set cgroup v2 limits for BG jobs */
+    {"history", do_history, 0}, /* list earlier command lines */
+    {"trace", do_trace, 0}, /* record job events for a Chrome trace */
+    {"kill", do_kill, 0},  /* signal jobs or processes, or cancel QU jobs */
+    {"&",    NULL, 0},     /* ignore singleton */
+    /* Utilities run in-process, also as /bin/name or /usr/bin/name; they
+     * run as programs with -B or after "command" */
+    {"echo", do_echo, 1},  /* print the arguments */
+    {"true", do_true, 1},  /* succeed */
+    {"false", do_false, 1}, /* fail */
+    {"test", do_test, 1},  /* evaluate an expression */
+    {"[",    do_test, 1},  /* same, ending in ] */
+    {"printf", do_printf, 1}, /* print the arguments in a format */
+    {"sleep", do_sleep, 1}, /* wait for a while */
+    {NULL,   NULL, 0}
+};
+
+/* findbuiltin - Return the built-in command called name, NULL if none */
+struct builtin_t *findbuiltin(char *name)
+{
+    struct builtin_t *b;
+    char *base = name;
+
+    if (strncmp(name, "/bin/", 5) == 0) base = name + 5;
+    else if (strncmp(name, "/usr/bin/", 9) == 0) base = name + 9;
+    for (b = builtins; b->name != NULL; b++)
+	if (strcmp(b->name, base) == 0 && (b->util ? !noutils : base == name))
+	    return b;
+    return NULL;
+}
+
+/* 
+ * builtin_cmd - If the user has typed a built-in command then execute
+ *    it immediately.  
+ */
+int builtin_cmd(char **argv)
+{
+    struct builtin_t *b;
+
+    if ((b = findbuiltin(argv[0])) == NULL) {
+        return 0;     /* not a builtin command */
+    }
+    if (b->fn != NULL) (*b->fn)(argv);
+    return 1;
+}
+
+/*
+ * do_quit - Execute the builtin quit command
+ */
+void do_quit(char **argv)
+{
+    exit(0); // exit from the shell.
+}
+
+/*
+ * do_jobs - Execute the builtin jobs command; jobs -l also shows what
+ *    the jobs that have a cgroup are using
+ */
+void do_jobs(char **argv)
+{
+    listjobs(&jobs, (argv[1] != NULL) && (strcmp(argv[1], "-l") == 0));
+}
+
+/* 
+ * do_bgfg - Execute the builtin bg and fg commands
+ */
+void do_bgfg(char **argv)
+/* due to parseline, argv[k] are words separated by space
+ * Ex) fg %1
+ * argv[0] = arg1 = 'fg'
+ * argv[1] = arg2 = %1
+ * arg2[0] = '%' // thus we can know that arg2 refers to JID
+*/ 
+{
+    struct job_t *do_job; // job for do_bgfg
+    char *arg1 = argv[0]; // 1st argument
+    char *arg2 = argv[1]; // 2nd argument
+
+    // Check is arg2 isn't missing
+    if (arg2 == NULL)
+    {
+	printf("%s command requires PID or %%jobid argument\n", arg1);
+	return;
+    }
+
+    int isJID = (arg2[0] == '%'); // JID starts with %
+    int isPID = ((arg2[0] >= 0x30) && (arg2[0] <= 0x39)); // PID starts with integer
+    
+    int i = 1;
+    while(arg2[i] > 0x20) // checks all characters in the arg2, breaks when <space> is present.
     {
 	// printf("%d\n", arg2[i]);
 	if ((arg2[i] < 0x30) || (arg2[i] > 0x39))
@@ -359,7 +1578,7 @@ void do_bgfg(char **argv)
     {
         // get the job of the called pid
         pid_t pid = (pid_t)(atoi(arg2));
-        do_job = getjobpid(jobs, pid);
+        do_job = getjobpid(&jobs, pid);
         // check if there's such job
         if (do_job == NULL)
         {
@@ -372,288 +1591,3672 @@ void do_bgfg(char **argv)
     {
         // get the job of the called jid
         int jid = atoi(&arg2[1]);
-        do_job = getjobjid(jobs, jid);
+        do_job = getjobjid(&jobs, jid);
         if (do_job == NULL)
         {
             printf("%s: No such job\n", arg2);
             return;
         }
     }
-    // neither JID nor PID
-    else
-    {
-        printf("%s: argument must be a PID or %%jobid\n", arg1);
-        return;
+    // neither JID nor PID
+    else
+    {
+        printf("%s: argument must be a PID or %%jobid\n", arg1);
+        return;
+    }
+
+    // a queued job is started (as BG) first, then handled like any other
+    if ((*do_job).state == QU)
+    {
+        int jid = (*do_job).jid;
+        unqueuejob(&jobs, do_job);
+        evaljob((*do_job).cmdline, do_job);
+        if ((do_job = getjobjid(&jobs, jid)) == NULL) return; // could not be started
+    }
+
+    // change the state according to arg1
+    if (strcmp(arg1, "bg") == 0)
+    {
+        // with cgroup limits on, a job sent to the background gets a cgroup too
+        if (cglimits.on && ((*do_job).cgroup == NULL) && (((*do_job).cgroup = cgcreate((*do_job).jid)) != NULL))
+        {
+            for (i = 0; i < (*do_job).nstages; i++)
+            {
+                pid_t pid = ((*do_job).pids != NULL) ? (*do_job).pids[i] : (*do_job).pid;
+                if (getjobpid(&jobs, pid) == do_job) cgmove((*do_job).cgroup, pid);
+            }
+        }
+        setjobstate(&jobs, do_job, BG); // change the job into BG
+        printf("[%d] (%d) %s", (*do_job).jid, (*do_job).pid, (*do_job).cmdline); // print BG
+	/*
+	 * int kill (pid_t pid, int sig);
+	 * sends signal 'sig' to the process (pid)
+	 * send SIGCONT so that the process can continue after its state has been changed. 
+	*/
+        TRACE('i', "continue", (*do_job).pid, (*do_job).pid, (*do_job).jid, SIGCONT);
+        kill(-(*do_job).pid, SIGCONT); // sends SIGCONT to continue as BG process.
+    }
+    else if (strcmp(arg1, "fg") == 0)
+    {
+        setjobstate(&jobs, do_job, FG); // change the job into FG
+        if ((*do_job).hastmodes) tcsetattr(input.fd, TCSADRAIN, &(*do_job).tmodes);
+        TRACE('i', "continue", (*do_job).pid, (*do_job).pid, (*do_job).jid, SIGCONT);
+        kill(-(*do_job).pid, SIGCONT); // sends SIGCONT to continue as FG process.
+        waitfg((*do_job).pid); // wait until pid (now FG) is finished. 
+    }
+    return;
+}
+
+/*
+ * do_hash - Execute the builtin hash command
+ *    hash          list the cached commands with their hit counts
+ *    hash -r       forget all cached commands
+ *    hash -s       print cache hit/miss counters
+ *    hash name...  look the names up and cache them
+ */
+void do_hash(char **argv)
+{
+    struct pathent_t *ent;
+    int i;
+
+    if (argv[1] == NULL)
+    {
+        if (pathcache.nentries == 0)
+        {
+            printf("hash: hash table empty\n");
+            return;
+        }
+        printf("hits\tcommand\n");
+        for (i = 0; i < pathcache.nbuckets; i++)
+            for (ent = pathcache.buckets[i]; ent != NULL; ent = ent->next)
+                printf("%4d\t%s\n", ent->hits, ent->path);
+    }
+    else if (strcmp(argv[1], "-r") == 0) clearpaths();
+    else if (strcmp(argv[1], "-s") == 0)
+    {
+        printf("hash: %lu hits, %lu misses, %d entries\n",
+               pathcache.hits, pathcache.misses, pathcache.nentries);
+    }
+    else
+    {
+        for (i = 1; argv[i] != NULL; i++)
+        {
+            if (strchr(argv[i], '/') != NULL) continue; // never cached
+            if (findpath(argv[i]) == NULL) printf("hash: %s: not found\n", argv[i]);
+        }
+    }
+    return;
+}
+
+/*
+ * do_history - Execute the builtin history command
+ *    history    list all earlier command lines, numbered for !n
+ *    history n  list the last n
+ */
+void do_history(char **argv)
+{
+    size_t i, len;
+    long n;
+    char *line;
+
+    if (!hist.on)
+    {
+        printf("history: not kept (set TSH_HISTFILE)\n");
+        return;
+    }
+    histsync();
+    i = 0;
+    if (argv[1] != NULL)
+    {
+        if ((n = atol(argv[1])) <= 0)
+        {
+            printf("history: %s: numeric argument required\n", argv[1]);
+            return;
+        }
+        if ((size_t)n < hist.n) i = hist.n - n;
+    }
+    for (; i < hist.n; i++)
+    {
+        line = histline(i, &len);
+        printf("%5zu  %.*s\n", i + 1, (int)len, line);
+    }
+    return;
+}
+
+/*
+ * do_jobstat - Execute the builtin jobstat command
+ *    jobstat            resources used so far by every job
+ *    jobstat %jid|pid   resources used so far by one job
+ */
+void do_jobstat(char **argv)
+{
+    struct job_t *job;
+    int i;
+
+    if (argv[1] == NULL)
+    {
+        for (i = 1; i <= maxjid(&jobs); i++)
+            if ((job = getjobjid(&jobs, i)) != NULL) printjobstat(&jobs, job);
+        return;
+    }
+    if (argv[1][0] == '%')
+    {
+        if ((job = getjobjid(&jobs, atoi(&argv[1][1]))) == NULL)
+        {
+            printf("%s: No such job\n", argv[1]);
+            return;
+        }
+    }
+    else if (isdigit((unsigned char)argv[1][0]))
+    {
+        if ((job = getjobpid(&jobs, (pid_t)atoi(argv[1]))) == NULL)
+        {
+            printf("(%d): No such process\n", atoi(argv[1]));
+            return;
+        }
+    }
+    else
+    {
+        printf("%s: argument must be a PID or %%jobid\n", argv[0]);
+        return;
+    }
+    printjobstat(&jobs, job);
+    return;
+}
+
+/*
+ * do_maxjobs - Execute the builtin maxjobs command
+ *    maxjobs      show the limit on running BG jobs and the queue length
+ *    maxjobs N    set the limit (0 = none) and admit queued jobs
+ */
+void do_maxjobs(char **argv)
+{
+    if (argv[1] == NULL)
+    {
+        printf("maxjobs: %d (%d running, %d queued)\n",
+               maxrunning, jobs.nstate[BG], jobs.nstate[QU]);
+        return;
+    }
+    if (!isdigit((unsigned char)argv[1][0]))
+    {
+        printf("maxjobs: %s: argument must be a number\n", argv[1]);
+        return;
+    }
+    maxrunning = atoi(argv[1]);
+    admitjobs();
+    return;
+}
+
+/* The signal names kill understands, besides numbers */
+static struct {
+    char *name;
+    int sig;
+} signames[] = {
+    {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL},
+    {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"TERM", SIGTERM}, {"CONT", SIGCONT},
+    {"STOP", SIGSTOP}, {"TSTP", SIGTSTP}, {NULL, 0}
+};
+
+/*
+ * do_kill - Execute the builtin kill command
+ *    kill [-SIG] %jid|pid...
+ *    SIG is a number or a name (with or without SIG), default TERM. A
+ *    %jid signals the job's process group; a queued job is cancelled.
+ */
+void do_kill(char **argv)
+{
+    int sig = SIGTERM;
+    struct job_t *job;
+    char *name;
+    int i = 1, k;
+
+    builtin_status = 1; // unless all arguments can be signalled
+
+    if ((argv[1] != NULL) && (argv[1][0] == '-'))
+    {
+        name = &argv[1][1];
+        if (strncmp(name, "SIG", 3) == 0) name += 3;
+        if (isdigit((unsigned char)name[0])) sig = atoi(name);
+        else
+        {
+            for (k = 0; (signames[k].name != NULL) && (strcmp(signames[k].name, name) != 0); k++);
+            if (signames[k].name == NULL)
+            {
+                printf("kill: %s: invalid signal specification\n", argv[1]);
+                return;
+            }
+            sig = signames[k].sig;
+        }
+        i++;
+    }
+    if (argv[i] == NULL)
+    {
+        printf("kill command requires PID or %%jobid argument\n");
+        return;
+    }
+
+    builtin_status = 0;
+    for (; argv[i] != NULL; i++)
+    {
+        if (argv[i][0] == '%')
+        {
+            if ((job = getjobjid(&jobs, atoi(&argv[i][1]))) == NULL)
+            {
+                printf("%s: No such job\n", argv[i]);
+                builtin_status = 1;
+            }
+            else if ((*job).state == QU)
+            {
+                printf("Job [%d] cancelled\n", (*job).jid);
+                canceljob(&jobs, job);
+            }
+            else if (kill(-(*job).pid, sig) < 0)
+            {
+                printf("kill: (%d): %s\n", (int)(*job).pid, strerror(errno));
+                builtin_status = 1;
+            }
+        }
+        else if (isdigit((unsigned char)argv[i][0]))
+        {
+            if (kill((pid_t)atoi(argv[i]), sig) < 0)
+            {
+                printf("kill: (%d): %s\n", atoi(argv[i]), strerror(errno));
+                builtin_status = 1;
+            }
+        }
+        else
+        {
+            printf("kill: %s: argument must be a PID or %%jobid\n", argv[i]);
+            builtin_status = 1;
+        }
+    }
+    return;
+}
+
+/*
+ * do_trace - Execute the builtin trace command
+ *    trace             show whether jobs are traced and how many events
+ *    trace on|off      start or stop recording job events
+ *    trace clear       forget the events recorded so far
+ *    trace dump file   write the events to file as a Chrome trace
+ */
+void do_trace(char **argv)
+{
+    unsigned long n = (tracebuf != NULL) ? tracebuf->head : 0;
+    long written;
+
+    if (argv[1] == NULL)
+        printf("trace: %s, %lu events (%lu overwritten)\n", tracing ? "on" : "off",
+               n, (n > TRACEBUF) ? n - TRACEBUF : 0);
+    else if (strcmp(argv[1], "on") == 0)
+        starttrace();
+    else if (strcmp(argv[1], "off") == 0)
+        tracing = 0;
+    else if (strcmp(argv[1], "clear") == 0)
+    {
+        if (tracebuf != NULL) tracebuf->head = 0;
+    }
+    else if ((strcmp(argv[1], "dump") == 0) && (argv[2] != NULL))
+    {
+        if ((written = dumptrace(argv[2])) >= 0)
+            printf("trace: %ld events written to %s\n", written, argv[2]);
+    }
+    else
+        printf("trace: usage: trace [on|off|clear|dump <file>]\n");
+    return;
+}
+
+/***********************************************
+ * Utility builtins
+ *
+ * These behave like the coreutils programs of the same name, but run in
+ * the shell (or, in a pipeline or in the background, in a forked copy of
+ * it), saving the exec. Their exit status is left in builtin_status.
+ ***********************************************/
+
+/*
+ * putesc - Print the backslash escape starting at *sp (just after the
+ *    backslash) and advance *sp past it. Octal escapes are \0NNN if
+ *    zero is set (echo, %b), else \NNN (printf formats). Returns -1 for
+ *    \c, which ends all output.
+ */
+static int putesc(const char **sp, int zero)
+{
+    const char *s = *sp;
+    int c = *s++, i;
+
+    switch (c) {
+    case 'a': c = '\a'; break;
+    case 'b': c = '\b'; break;
+    case 'c': *sp = s; return -1;
+    case 'e': c = 033; break;
+    case 'f': c = '\f'; break;
+    case 'n': c = '\n'; break;
+    case 'r': c = '\r'; break;
+    case 't': c = '\t'; break;
+    case 'v': c = '\v'; break;
+    case '\\': break;
+    case 'x':
+	if (!isxdigit((unsigned char)*s)) {
+	    putchar('\\');
+	    break;
+	}
+	for (c = 0, i = 0; i < 2 && isxdigit((unsigned char)*s); i++, s++)
+	    c = c * 16 + (isdigit((unsigned char)*s) ? *s - '0' : (tolower((unsigned char)*s) - 'a' + 10));
+	break;
+    case '0': case '1': case '2': case '3':
+    case '4': case '5': case '6': case '7':
+	if (zero && c != '0') {
+	    putchar('\\');
+	    break;
+	}
+	c = zero ? 0 : c - '0';
+	for (i = zero ? 0 : 1; i < 3 && *s >= '0' && *s <= '7'; i++, s++)
+	    c = c * 8 + (*s - '0');
+	break;
+    case '\0':
+	s--;
+	c = '\\';
+	break;
+    default:
+	putchar('\\');
+    }
+    putchar(c);
+    *sp = s;
+    return 0;
+}
+
+/* putescaped - Print str interpreting echo's escapes; -1 if it had \c */
+static int putescaped(const char *str)
+{
+    while (*str) {
+	if (*str++ != '\\')
+	    putchar(str[-1]);
+	else if (putesc(&str, 1) < 0)
+	    return -1;
+    }
+    return 0;
+}
+
+/*
+ * do_echo - Execute the builtin echo command
+ *    echo [-neE] [arg...]  print the arguments; -n: no newline, -e:
+ *    interpret backslash escapes, -E: don't (default)
+ */
+void do_echo(char **argv)
+{
+    int nl = 1, esc = 0;
+    int i, first;
+    char *p;
+
+    // options are words of n, e and E after a -, up to the first other word
+    for (i = 1; (argv[i] != NULL) && (argv[i][0] == '-') && (argv[i][1] != '\0') &&
+             (strspn(&argv[i][1], "neE") == strlen(&argv[i][1])); i++)
+    {
+        for (p = &argv[i][1]; *p; p++)
+        {
+            if (*p == 'n') nl = 0;
+            else esc = (*p == 'e');
+        }
+    }
+
+    builtin_status = 0;
+    for (first = i; argv[i] != NULL; i++)
+    {
+        if (i > first) putchar(' ');
+        if (!esc) fputs(argv[i], stdout);
+        else if (putescaped(argv[i]) < 0) return; // \c: stop here, no newline
+    }
+    if (nl) putchar('\n');
+    return;
+}
+
+/* do_true - Execute the builtin true command */
+void do_true(char **argv)
+{
+    builtin_status = 0;
+}
+
+/* do_false - Execute the builtin false command */
+void do_false(char **argv)
+{
+    builtin_status = 1;
+}
+
+/* testint - Parse an integer operand of test; sets *bad if it isn't one */
+static long long testint(const char *str, int *bad)
+{
+    char *end;
+    long long n;
+
+    while (isspace((unsigned char)*str)) str++;
+    n = strtoll(str, &end, 10);
+    while (isspace((unsigned char)*end)) end++;
+    if ((end == str) || (*end != '\0'))
+    {
+        if (!*bad) printf("test: %s: integer expression expected\n", str);
+        *bad = 1;
+    }
+    return n;
+}
+
+/* testunary - Evaluate the unary primary op arg */
+static int testunary(const char *op, const char *arg)
+{
+    struct stat sb;
+
+    switch (op[1])
+    {
+    case 'n': return arg[0] != '\0';
+    case 'z': return arg[0] == '\0';
+    case 'r': return access(arg, R_OK) == 0;
+    case 'w': return access(arg, W_OK) == 0;
+    case 'x': return access(arg, X_OK) == 0;
+    case 't': return isatty(atoi(arg));
+    case 'h': case 'L': return (lstat(arg, &sb) == 0) && S_ISLNK(sb.st_mode);
+    }
+    if (stat(arg, &sb) < 0) return 0;
+    switch (op[1])
+    {
+    case 'e': return 1;
+    case 'f': return S_ISREG(sb.st_mode);
+    case 'd': return S_ISDIR(sb.st_mode);
+    case 's': return sb.st_size > 0;
+    case 'b': return S_ISBLK(sb.st_mode);
+    case 'c': return S_ISCHR(sb.st_mode);
+    case 'p': return S_ISFIFO(sb.st_mode);
+    case 'S': return S_ISSOCK(sb.st_mode);
+    }
+    return 0;
+}
+
+/* testbinary - Evaluate the binary primary a op b; -1 if op isn't one */
+static int testbinary(const char *a, const char *op, const char *b, int *bad)
+{
+    static char *intops[] = {"-eq", "-ne", "-lt", "-le", "-gt", "-ge", NULL};
+    long long x, y;
+    int k;
+
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) return strcmp(a, b) == 0;
+    if (strcmp(op, "!=") == 0) return strcmp(a, b) != 0;
+    if (strcmp(op, "<") == 0) return strcmp(a, b) < 0;
+    if (strcmp(op, ">") == 0) return strcmp(a, b) > 0;
+    for (k = 0; (intops[k] != NULL) && (strcmp(op, intops[k]) != 0); k++);
+    if (intops[k] == NULL) return -1;
+    x = testint(a, bad);
+    y = testint(b, bad);
+    switch (k)
+    {
+    case 0: return x == y;
+    case 1: return x != y;
+    case 2: return x < y;
+    case 3: return x <= y;
+    case 4: return x > y;
+    default: return x >= y;
+    }
+}
+
+static int testor(char **argv, int *i, int n, int *bad);
+
+/* testprimary - primary: ( expr ) | -op arg | arg op arg | arg */
+static int testprimary(char **argv, int *i, int n, int *bad)
+{
+    int r;
+
+    if (*i >= n)
+    {
+        if (!*bad) printf("test: argument expected\n");
+        *bad = 1;
+        return 0;
+    }
+    // a binary operator decides first, so that e.g. "-n = -n" compares
+    if ((*i + 2 < n) && ((r = testbinary(argv[*i], argv[*i + 1], argv[*i + 2], bad)) >= 0))
+    {
+        *i += 3;
+        return r;
+    }
+    if ((strcmp(argv[*i], "(") == 0) && (*i + 1 < n))
+    {
+        (*i)++;
+        r = testor(argv, i, n, bad);
+        if ((*i >= n) || (strcmp(argv[*i], ")") != 0))
+        {
+            if (!*bad) printf("test: missing )\n");
+            *bad = 1;
+        }
+        (*i)++;
+        return r;
+    }
+    if ((argv[*i][0] == '-') && (argv[*i][1] != '\0') && (argv[*i][2] == '\0') &&
+        strchr("nzrwxthLefdsbcpS", argv[*i][1]) && (*i + 1 < n))
+    {
+        *i += 2;
+        return testunary(argv[*i - 2], argv[*i - 1]);
+    }
+    return argv[(*i)++][0] != '\0';
+}
+
+/* testnot - not: ! not | primary */
+static int testnot(char **argv, int *i, int n, int *bad)
+{
+    if ((*i + 1 < n) && (strcmp(argv[*i], "!") == 0))
+    {
+        (*i)++;
+        return !testnot(argv, i, n, bad);
+    }
+    return testprimary(argv, i, n, bad);
+}
+
+/* testand - and: not [-a and] */
+static int testand(char **argv, int *i, int n, int *bad)
+{
+    int r = testnot(argv, i, n, bad);
+
+    while ((*i < n) && (strcmp(argv[*i], "-a") == 0))
+    {
+        (*i)++;
+        r = testnot(argv, i, n, bad) && r;
+    }
+    return r;
+}
+
+/* testor - expr: and [-o expr] */
+static int testor(char **argv, int *i, int n, int *bad)
+{
+    int r = testand(argv, i, n, bad);
+
+    while ((*i < n) && (strcmp(argv[*i], "-o") == 0))
+    {
+        (*i)++;
+        r = testand(argv, i, n, bad) || r;
+    }
+    return r;
+}
+
+/*
+ * do_test - Execute the builtin test and [ commands: status 0 if the
+ *    expression is true, 1 if false, 2 if malformed
+ */
+void do_test(char **argv)
+{
+    int n, i = 1, bad = 0, r;
+
+    for (n = 0; argv[n] != NULL; n++);
+    if (strcmp(argv[0], "[") == 0)
+    {
+        if (strcmp(argv[n - 1], "]") != 0)
+        {
+            printf("[: missing ]\n");
+            builtin_status = 2;
+            return;
+        }
+        n--;
+    }
+    if (n == 1)
+    {
+        builtin_status = 1; // no expression is false
+        return;
+    }
+    r = testor(argv, &i, n, &bad);
+    if (!bad && (i < n))
+    {
+        printf("test: %s: unexpected argument\n", argv[i]);
+        bad = 1;
+    }
+    builtin_status = bad ? 2 : !r;
+    return;
+}
+
+/* printfnum - The numeric value of a printf argument ('c gives c's code) */
+static long long printfnum(const char *arg)
+{
+    char *end;
+    long long n;
+
+    if ((arg[0] == '\'') || (arg[0] == '"')) return (unsigned char)arg[1];
+    n = strtoll(arg, &end, 0);
+    if ((end == arg && *arg != '\0') || (*end != '\0'))
+    {
+        printf("printf: %s: invalid number\n", arg);
+        builtin_status = 1;
+    }
+    return n;
+}
+
+/*
+ * do_printf - Execute the builtin printf command
+ *    printf format [arg...]  print the arguments as format says, reusing
+ *    it while arguments remain. Supports the flags, width and precision
+ *    (also *) of the conversions diouxXcs, eEfFgGaA, %b and %%.
+ */
+void do_printf(char **argv)
+{
+    char *fmt = argv[1];        // the format
+    char **args;                // next argument
+    char spec[64];              // one conversion, for the C printf
+    const char *p, *arg;
+    int len, used;
+
+    if (fmt == NULL)
+    {
+        printf("printf: usage: printf format [arguments]\n");
+        builtin_status = 2;
+        return;
+    }
+    builtin_status = 0;
+    args = &argv[2];
+    do
+    {
+        used = 0;
+        for (p = fmt; *p; )
+        {
+            if (*p == '\\')
+            {
+                p++;
+                if (putesc(&p, 0) < 0) return;
+                continue;
+            }
+            if ((*p != '%') || (p[1] == '%') || (p[1] == '\0'))
+            {
+                putchar(*p);
+                p += (*p == '%' && p[1] == '%') ? 2 : 1;
+                continue;
+            }
+
+            // copy %[flags][width][.precision] into spec, filling in any *
+            len = 0;
+            spec[len++] = *p++;
+            while (*p && strchr("-+ #0", *p) && len < 8) spec[len++] = *p++;
+            if (*p == '*')
+            {
+                len += sprintf(&spec[len], "%d", (int)((*args != NULL) ? printfnum(*args++) : 0));
+                used = 1;
+                p++;
+            }
+            else while (isdigit((unsigned char)*p) && len < 24) spec[len++] = *p++;
+            if (*p == '.')
+            {
+                spec[len++] = *p++;
+                if (*p == '*')
+                {
+                    len += sprintf(&spec[len], "%d", (int)((*args != NULL) ? printfnum(*args++) : 0));
+                    used = 1;
+                    p++;
+                }
+                else while (isdigit((unsigned char)*p) && len < 48) spec[len++] = *p++;
+            }
+
+            arg = (*args != NULL) ? *args++ : NULL;
+            if (arg != NULL) used = 1;
+            switch (*p)
+            {
+            case 'd': case 'i':
+                strcpy(&spec[len], "lld");
+                printf(spec, (arg != NULL) ? printfnum(arg) : 0LL);
+                break;
+            case 'o': case 'u': case 'x': case 'X':
+                sprintf(&spec[len], "ll%c", *p);
+                printf(spec, (unsigned long long)((arg != NULL) ? printfnum(arg) : 0LL));
+                break;
+            case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+                sprintf(&spec[len], "%c", *p);
+                printf(spec, (arg != NULL) ? strtod(arg, NULL) : 0.0);
+                break;
+            case 'c':
+                strcpy(&spec[len], "c");
+                if ((arg != NULL) && (arg[0] != '\0')) printf(spec, arg[0]); // no NUL for ""
+                break;
+            case 's':
+                strcpy(&spec[len], "s");
+                printf(spec, (arg != NULL) ? arg : "");
+                break;
+            case 'b':
+                if ((arg != NULL) && (putescaped(arg) < 0)) return;
+                break;
+            default:
+                printf("printf: %%%c: invalid conversion\n", *p ? *p : ' ');
+                builtin_status = 1;
+                return;
+            }
+            p++;
+        }
+    } while (used && (*args != NULL));
+    return;
+}
+
+/*
+ * do_sleep - Execute the builtin sleep command
+ *    sleep n[smhd]...  wait for the sum of the intervals. In the shell
+ *    itself signals are handled meanwhile and ctrl-c ends the wait (it
+ *    can't be stopped with ctrl-z; "command sleep" can).
+ */
+void do_sleep(char **argv)
+{
+    struct timespec now, end;
+    double secs = 0, n;
+    long long left;
+    struct pollfd pfd;
+    char *p;
+    int i;
+
+    if (argv[1] == NULL)
+    {
+        printf("sleep: missing operand\n");
+        builtin_status = 1;
+        return;
+    }
+    for (i = 1; argv[i] != NULL; i++)
+    {
+        n = strtod(argv[i], &p);
+        if ((p == argv[i]) || (n < 0) || ((*p != '\0') && ((p[1] != '\0') || !strchr("smhd", *p))))
+        {
+            printf("sleep: invalid time interval '%s'\n", argv[i]);
+            builtin_status = 1;
+            return;
+        }
+        secs += n * ((*p == 'm') ? 60 : (*p == 'h') ? 3600 : (*p == 'd') ? 86400 : 1);
+    }
+
+    builtin_status = 0;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    end.tv_sec += (time_t)secs;
+    end.tv_nsec += (long)((secs - (time_t)secs) * 1e9);
+    if (end.tv_nsec >= 1000000000) { end.tv_sec++; end.tv_nsec -= 1000000000; }
+    if (getpid() != shellpid)
+    {
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &end, NULL) == EINTR);
+        return;
+    }
+
+    fflush(stdout);
+    interrupted = 0;
+    pfd.fd = sigfd;
+    pfd.events = POLLIN;
+    while (!interrupted)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        left = (end.tv_sec - now.tv_sec) * 1000LL + (end.tv_nsec - now.tv_nsec + 999999) / 1000000;
+        if (left <= 0) break;
+        if ((poll(&pfd, 1, (left > 1000000) ? 1000000 : (int)left) < 0) && (errno != EINTR))
+            unix_error("poll error");
+        dispatch_signals();
+    }
+    if (interrupted) builtin_status = 130;
+    return;
+}
+
+/* cgsize - Parse a size like 512M into bytes for memory.max; -1 if malformed */
+static long long cgsize(const char *str)
+{
+    char *end;
+    long long n = strtoll(str, &end, 10);
+
+    if (end == str || n < 0)
+        return -1;
+    switch (*end) {
+    case 'G': case 'g': n <<= 10; /* fall through */
+    case 'M': case 'm': n <<= 10; /* fall through */
+    case 'K': case 'k': n <<= 10; end++;
+    }
+    return (*end == '\0') ? n : -1;
+}
+
+/*
+ * do_cgroup - Execute the builtin cgroup command
+ *    cgroup                          show the settings
+ *    cgroup [-c pct] [-m size] [-p n]  run later BG jobs in their own cgroup
+ *                                    with at most pct% of a CPU, size bytes
+ *                                    (K, M or G suffix) and n processes
+ *    cgroup off                      stop making cgroups for BG jobs
+ *    Limits whose controller isn't delegated to us are skipped with a
+ *    warning; if cgroups can't be made at all, jobs run as before.
+ */
+void do_cgroup(char **argv)
+{
+    struct cglimits_t new;
+    char ctl[256];
+    char *base, *end;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    long long n;
+    int i, fd, len;
+
+    if (argv[1] == NULL)
+    {
+        printf("cgroup: %s", cglimits.on ? "on" : "off");
+        if (cglimits.on)
+            printf(", cpu.max %s, memory.max %s, pids.max %s, in %s",
+                   cglimits.cpu[0] ? cglimits.cpu : "max", cglimits.mem[0] ? cglimits.mem : "max",
+                   cglimits.pids[0] ? cglimits.pids : "max", cglimits.base);
+        printf("\n");
+        return;
+    }
+    if (strcmp(argv[1], "off") == 0)
+    {
+        cglimits.on = 0;
+        return;
+    }
+
+    new = cglimits;
+    new.cpu[0] = new.mem[0] = new.pids[0] = '\0';
+    for (i = 1; argv[i] != NULL; i += 2)
+    {
+        if ((argv[i + 1] == NULL) || (argv[i][0] != '-') || (argv[i][2] != '\0'))
+        {
+            printf("usage: cgroup [-c cpu%%] [-m size] [-p pids] | off\n");
+            return;
+        }
+        // only a memory size takes a K, M or G suffix
+        if (argv[i][1] == 'm') n = cgsize(argv[i + 1]);
+        else if (((n = strtoll(argv[i + 1], &end, 10)) <= 0) || (*end != '\0')) n = -1;
+        if (n <= 0)
+        {
+            printf("usage: cgroup [-c cpu%%] [-m size] [-p pids] | off\n");
+            return;
+        }
+        switch (argv[i][1])
+        {
+        case 'c':
+            if (n > 100 * ncpus)
+            {
+                printf("cgroup: -c %lld: at most %ld%% with %ld CPUs\n", n, 100 * ncpus, ncpus);
+                return;
+            }
+            sprintf(new.cpu, "%lld 100000", n * 1000);
+            break;
+        case 'm': sprintf(new.mem, "%lld", n); break;
+        case 'p': sprintf(new.pids, "%lld", n); break;
+        default:
+            printf("usage: cgroup [-c cpu%%] [-m size] [-p pids] | off\n");
+            return;
+        }
+    }
+    if ((base = cgbase()) == NULL) return; // no cgroups, no change
+    new.base = base;
+
+    // the controllers we may use in job cgroups are those enabled in base
+    len = 0;
+    sprintf(ctl, "%s/cgroup.subtree_control", base);
+    if ((fd = open(ctl, O_RDONLY)) >= 0)
+    {
+        if ((len = read(fd, ctl, sizeof(ctl) - 1)) < 0) len = 0;
+        close(fd);
+    }
+    ctl[len] = '\0';
+    if (new.cpu[0] && !strstr(ctl, "cpu"))
+        printf("cgroup: cpu controller not available, no CPU limit\n");
+    if (new.mem[0] && !strstr(ctl, "memory"))
+        printf("cgroup: memory controller not available, no memory limit\n");
+    if (new.pids[0] && !strstr(ctl, "pids"))
+        printf("cgroup: pids controller not available, no process limit\n");
+    new.on = 1;
+    cglimits = new;
+    return;
+}
+
+/* readargs - Append the lines of fp (without newlines) to *args */
+static void readargs(FILE *fp, char ***args, int *nargs, int *cap)
+{
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+
+    while ((len = getline(&line, &size, fp)) >= 0)
+    {
+        if ((len > 0) && (line[len - 1] == '\n')) line[--len] = '\0';
+        if (len == 0) continue;
+        if (*nargs == *cap)
+        {
+            *cap = (*cap == 0) ? MINJOBS : 2 * *cap;
+            *args = Realloc(*args, *cap * sizeof(char *));
+        }
+        (*args)[(*nargs)++] = strdup(line);
+    }
+    free(line);
+}
+
+/*
+ * do_parallel - Execute the builtin parallel command
+ *    parallel [-j N] command [word...] ::: arg...
+ *    parallel [-j N] command [word...] :::: file|-
+ *    parallel [-j N] command [word...]            (arguments from stdin)
+ *    Runs the command once per argument, which replaces each {} word or
+ *    else is appended, keeping N tasks (default: one per online CPU)
+ *    running. All tasks belong to one foreground job, so ctrl-c and
+ *    ctrl-z reach every running task; after ctrl-c no more are started.
+ */
+void do_parallel(char **argv)
+{
+    char **args = NULL;         // the arguments, one per task
+    int nargs = 0, cap = 0;     // number of arguments and slots in args
+    int owned = 0;              // args[] were read (and strdup'd)
+    char **task;                // argv of the next task
+    int ncmd;                   // number of words of the command
+    int hole;                   // index of the {} word in task, or ncmd
+    long n = sysconf(_SC_NPROCESSORS_ONLN); // tasks to keep running
+    char cmdline[MAXLINE];      // command line of the job
+    struct timespec t0, t1;     // start and end of the run
+    long long ns;
+    struct job_t *job = NULL;   // the job running the tasks
+    int jid = 0;                // JID of that job
+    int next = 0, started = 0;  // next argument, number of tasks started
+    struct stat sb;
+    FILE *fp;
+    pid_t pid;
+    int i, k;
+
+    if (getpid() != shellpid)
+    {
+        printf("parallel: can't run in a pipeline; use :::: file or < file\n");
+        return;
+    }
+    i = 1;
+    if ((argv[i] != NULL) && (strcmp(argv[i], "-j") == 0) && (argv[i + 1] != NULL))
+    {
+        n = atol(argv[i + 1]);
+        i += 2;
+    }
+    if ((n < 1) || (argv[i] == NULL) || (strncmp(argv[i], ":::", 3) == 0))
+    {
+        printf("usage: parallel [-j N] command [word...] [::: arg... | :::: file]\n");
+        return;
+    }
+
+    // the command is argv[i..k-1]; the arguments follow ::: or come from a file
+    for (k = i; (argv[k] != NULL) && (strcmp(argv[k], ":::") != 0) && (strcmp(argv[k], "::::") != 0); k++);
+    ncmd = k - i;
+    if ((argv[k] != NULL) && (strcmp(argv[k], ":::") == 0))
+    {
+        args = &argv[k + 1];
+        for (nargs = 0; args[nargs] != NULL; nargs++);
+    }
+    else
+    {
+        owned = 1;
+        if ((argv[k] != NULL) && (argv[k + 1] != NULL) && (strcmp(argv[k + 1], "-") != 0))
+        {
+            if ((fp = fopen(argv[k + 1], "r")) == NULL)
+            {
+                printf("%s: %s\n", argv[k + 1], strerror(errno));
+                return;
+            }
+        }
+        else
+        {
+            // don't eat the shell's own command lines
+            if ((fstat(STDIN_FILENO, &sb) == 0) && (sb.st_dev == input.dev) && (sb.st_ino == input.ino) &&
+                !isatty(STDIN_FILENO))
+            {
+                printf("parallel: standard input is the command input; use :::: file or < file\n");
+                return;
+            }
+            if ((fp = fdopen(dup(STDIN_FILENO), "r")) == NULL) unix_error("fdopen error");
+        }
+        readargs(fp, &args, &nargs, &cap);
+        fclose(fp);
+    }
+
+    // the task's argv: the command words, then the argument unless one word is {}
+    task = Realloc(NULL, (ncmd + 2) * sizeof(char *));
+    hole = ncmd;
+    for (k = 0; k < ncmd; k++)
+    {
+        task[k] = argv[i + k];
+        if ((hole == ncmd) && (strcmp(task[k], "{}") == 0)) hole = k;
+    }
+    task[(hole == ncmd) ? ncmd + 1 : ncmd] = NULL;
+
+    // the job's command line, as typed (truncated if long)
+    cmdline[0] = '\0';
+    for (k = 0; (argv[k] != NULL) && (strlen(cmdline) + strlen(argv[k]) + 2 < MAXLINE); k++)
+    {
+        if (k > 0) strcat(cmdline, " ");
+        strcat(cmdline, argv[k]);
+    }
+    strcat(cmdline, "\n");
+
+    interrupted = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while (1)
+    {
+        // the job is deleted whenever all of its tasks are done
+        job = (jid != 0) ? getjobjid(&jobs, jid) : NULL;
+        if ((job != NULL) && ((*job).state != FG)) break; // stopped (ctrl-z)
+
+        // top up to n running tasks, as one job in one process group
+        if (next < nargs) fflush(stdout);
+        while (!interrupted && (next < nargs) && ((job == NULL) || ((*job).nlive < n)))
+        {
+            task[hole] = args[next++];
+            if ((pid = launchstage(task, NULL, 0, -1, -1, (job != NULL) ? (*job).pid : 0, NULL)) == 0)
+            {
+                next = nargs; // command not found
+                break;
+            }
+            started++;
+            if (job == NULL)
+            {
+                addjob(&jobs, pid, FG, cmdline);
+                jid = pid2jid(pid);
+                job = getjobjid(&jobs, jid);
+            }
+            else addjobpid(&jobs, jid, pid);
+        }
+        if (job == NULL) break; // nothing left to run
+        wait_signals();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    ns = (t1.tv_sec - t0.tv_sec) * 1000000000LL + (t1.tv_nsec - t0.tv_nsec);
+    printf("parallel: %d tasks in %lld.%03llds, %.1f tasks/sec (-j %ld)\n",
+           started, ns / 1000000000, ns / 1000000 % 1000,
+           (ns > 0) ? started * 1e9 / ns : 0.0, n);
+    if (next < nargs) printf("parallel: %d arguments not started\n", nargs - next);
+
+    free(task);
+    if (owned)
+    {
+        for (k = 0; k < nargs; k++) free(args[k]);
+        free(args);
+    }
+    return;
+}
+
+/* 
+ * waitfg - Block until process pid is no longer the foreground process
+ */
+void waitfg(pid_t pid)
+{
+    // in waitfg, sleep on sigfd and let sigchld_handler do the reaping.
+    struct job_t *job; // job of pid
+    int jid; // JID of the job
+
+    if (!pid) return; // is pid valid?
+    if ((jid = pid2jid(pid)) == 0) return;
+    TRACESHELL('B', "wait");
+
+    // signals are only consumed by wait_signals(), so nothing can change the
+    // state between the check and the wait (no lost wakeup).
+    // deletejob() frees the job, so look it up again after every wakeup. The
+    // lookup is by JID since pid itself is unmapped once its stage is reaped.
+    while (((job = getjobjid(&jobs, jid)) != NULL) && ((*job).pid == pid) && ((*job).state == FG)) {wait_signals();}
+    TRACESHELL('E', "wait");
+
+    // a stopped job gets its terminal modes back when it is continued in
+    // FG; the line editor resets them for the shell.
+    if (editor.on && (job != NULL) && ((*job).pid == pid) && ((*job).state == ST))
+        (*job).hastmodes = (tcgetattr(input.fd, &(*job).tmodes) == 0);
+    return;
+}
+
+/*****************
+ * Signal handlers
+ *
+ * These are not installed with sigaction(); the signals stay blocked and
+ * dispatch_signals() calls the handlers from the event loop when sigfd
+ * reports them, so they may safely touch the job list. Job state changes,
+ * and the -v and time reports of finished jobs, are posted to evring and
+ * printed by the main loop before the prompt.
+ *****************/
+
+/* 
+ * sigchld_handler - The kernel sends a SIGCHLD to the shell whenever
+ *     a child job terminates (becomes a zombie), or stops because it
+ *     received a SIGSTOP or SIGTSTP signal. The handler reaps all
+ *     available zombie children, but doesn't wait for any other
+ *     currently running children to terminate.  
+ */
+void sigchld_handler(int sig)
+{
+    pid_t pid_chld;
+    int status;
+    struct rusage ru; // resources used by a terminated child
+    struct job_t *job; // job of the child
+    int jid, termsig; // saved before the job is deleted
+    pid_t pgid;
+    struct jobreport_t rep; // -v and time reports of a finished job
+
+    // WNOHANG: return 0 if no child in the wait set is terminated or stopped
+    // WUNTRACED: return pid if any child in wait set is signaled or stopped
+    // wait4 also reports the resources a terminated child used.
+    while((pid_chld = wait4(-1, &status, WUNTRACED | WNOHANG, &ru)) > 0)
+    {
+        if ((job = getjobpid(&jobs, pid_chld)) == NULL) continue; // not one of our jobs
+
+        // child terminated normally (WIFEXITED = 1) or by signal (WIFSIGNALED = 1).
+        // a pipeline is deleted (and reported) when its last stage is reaped.
+        // SIGPIPE is how a writer learns that a later stage is done, so it isn't reported.
+        if (WIFEXITED(status) || WIFSIGNALED(status))
+        {
+            TRACE('E', "reap", pid_chld, (*job).pid, (*job).jid, WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+            if (WIFSIGNALED(status) && (WTERMSIG(status) != SIGPIPE) && ((*job).termsig == 0)) (*job).termsig = WTERMSIG(status);
+            addrusage(&(*job).ru, &ru);
+            jid = (*job).jid;
+            pgid = (*job).pid;
+            termsig = (*job).termsig;
+            if ((*job).nlive == 1)
+            {
+                // the reports are taken now, while the job still exists, and
+                // printed in order with the job's other events. the command
+                // line goes with them (freejob skips a NULL one).
+                if (verbose || (*job).timed)
+                {
+                    fillreport(&jobs, job, &rep);
+                    rep.show = (verbose ? REP_STAT : 0) | ((*job).timed ? REP_TIMES : 0);
+                    (*job).cmdline = NULL;
+                    postevent(EV_REPORT, 0, jid, pgid, &rep);
+                }
+                deletejob(&jobs, pid_chld); // delete the child process
+                if (termsig) postevent(EV_TERMINATED, termsig, jid, pgid, NULL);
+            }
+            else deletejob(&jobs, pid_chld); // only this stage is gone
+        }
+        // if stop signal arrived to child, WIFSTOPPED = 1 (distinguish stopped and terminated childs)
+        else if (WIFSTOPPED(status))
+        {
+            TRACE('i', "stop", pid_chld, (*job).pid, (*job).jid, WSTOPSIG(status));
+            if ((*job).state == ST) continue; // another stage of a stopped pipeline
+            setjobstate(&jobs, job, ST); // set the state as STOPPED
+            postevent(EV_STOPPED, WSTOPSIG(status), (*job).jid, (*job).pid, NULL);
+        }
+    }
+    return;
+}
+
+/* 
+ * sigint_handler - The kernel sends a SIGINT to the shell whenver the
+ *    user types ctrl-c at the keyboard.  Catch it and send it along
+ *    to the foreground job.  
+ */
+void sigint_handler(int sig)
+{
+    pid_t pid_fg = fgpid(&jobs); // current FG process in the jobs list
+    if (pid_fg != 0) kill(-pid_fg, sig); // SIGINT sent to FG process group
+    interrupted = 1; // stops parallel, and the sleep builtin
+    return;
+}
+
+/*
+ * sigtstp_handler - The kernel sends a SIGTSTP to the shell whenever
+ *     the user types ctrl-z at the keyboard. Catch it and suspend the
+ *     foreground job by sending it a SIGTSTP.  
+ */
+void sigtstp_handler(int sig)
+{
+    pid_t pid_fg = fgpid(&jobs); // current FG process in the jobs list
+    if (pid_fg != 0) kill(-pid_fg, sig); // SIGTSTP sent to FG process group
+    return;
+}
+/*********************
+ * End signal handlers
+ *********************/
+
+/*************************
+ * Job event notification
+ *
+ * sigchld_handler posts fixed-size records to evring; the main loop
+ * renders them before each prompt. Posting doesn't lock, allocate or
+ * format, and stop and termination lines are rendered without stdio
+ * formatting. Reports of finished jobs (-v, time) are printed with printf
+ * and release the job's command line, and a full ring is drained from
+ * postevent, so all of this relies on the handlers being dispatched
+ * synchronously from the signalfd loop, not run asynchronously.
+ *************************/
+
+/* fmtint - Append the decimal form of n to buf; returns the new end */
+static char *fmtint(char *buf, long n)
+{
+    char digits[24];
+    int i = 0;
+
+    if (n < 0) {
+	*buf++ = '-';
+	n = -n;
+    }
+    do {
+	digits[i++] = '0' + n % 10;
+	n /= 10;
+    } while (n > 0);
+    while (i > 0)
+	*buf++ = digits[--i];
+    return buf;
+}
+
+/* fmtstr - Append str to buf; returns the new end */
+static char *fmtstr(char *buf, const char *str)
+{
+    while (*str)
+	*buf++ = *str++;
+    return buf;
+}
+
+/* fmtevent - Render ev as a line in buf; returns its length (< 80) */
+static int fmtevent(char *buf, const struct jobevent_t *ev)
+{
+    char *p = buf;
+
+    p = fmtstr(p, "Job [");
+    p = fmtint(p, ev->jid);
+    p = fmtstr(p, "] (");
+    p = fmtint(p, ev->pid);
+    p = fmtstr(p, (ev->type == EV_STOPPED) ? ") stopped by signal " : ") terminated by signal ");
+    p = fmtint(p, ev->sig);
+    *p++ = '\n';
+    return p - buf;
+}
+
+/*
+ * postevent - Queue a job event; an EV_REPORT copies *rep and takes over
+ *    its command line. If the ring is full it is drained first, which is
+ *    possible because the handlers run from the event loop.
+ */
+void postevent(int type, int sig, int jid, pid_t pid, struct jobreport_t *rep)
+{
+    unsigned int head = __atomic_load_n(&evring.head, __ATOMIC_RELAXED);
+    struct jobevent_t *ev;
+    struct timespec now;
+
+    if (head - __atomic_load_n(&evring.tail, __ATOMIC_ACQUIRE) == EVRING)
+	drainevents();
+    ev = &evring.ev[head & (EVRING - 1)];
+    ev->type = type;
+    ev->sig = sig;
+    ev->jid = jid;
+    ev->pid = pid;
+    if (rep != NULL)
+	ev->rep = *rep;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ev->ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+    __atomic_store_n(&evring.head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* drainevents - Print the queued job events, oldest first */
+void drainevents(void)
+{
+    unsigned int tail = __atomic_load_n(&evring.tail, __ATOMIC_RELAXED);
+    unsigned int head = __atomic_load_n(&evring.head, __ATOMIC_ACQUIRE);
+    char buf[EVRING * 80];
+    struct timespec now;
+    long long ns;
+    int len = 0;
+
+    if (tail == head)
+	return;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+    for (; tail != head; tail++) {
+	struct jobevent_t *ev = &evring.ev[tail & (EVRING - 1)];
+	if (ev->type == EV_REPORT) {
+	    fwrite(buf, 1, len, stdout);
+	    len = 0;
+	    if (ev->rep.show & REP_STAT)
+		printstat(ev->jid, ev->pid, &ev->rep);
+	    if (ev->rep.show & REP_TIMES)
+		printtimes(ev->rep.activens, &ev->rep.utime, &ev->rep.stime);
+	    pool_free(&jobs.cmdlines, ev->rep.cmdline);
+	} else {
+	    len += fmtevent(buf + len, ev);
+	    TRACE('i', "notify", ev->pid, ev->pid, ev->jid, ev->sig);
+	}
+	if (ns - ev->ns > evring.maxlat)
+	    evring.maxlat = ns - ev->ns;
+	evring.nevents++;
+    }
+    __atomic_store_n(&evring.tail, tail, __ATOMIC_RELEASE);
+    fwrite(buf, 1, len, stdout);  /* in order with the rest of stdout */
+}
+
+/*************
+ * Job tracing
+ *
+ * With tracing on, the shell records when it reads, parses and evaluates
+ * each line, forks or spawns each stage, waits for FG jobs and notifies
+ * job events, and when each process execs, stops, is continued and is
+ * reaped. Events go to a fixed ring mapped shared, so a forked child can
+ * record its own exec; dumptrace writes them as Chrome trace JSON (for
+ * chrome://tracing or ui.perfetto.dev) with a track per process, grouped
+ * by job. With tracing off each hook is a single branch (see TRACE).
+ *************/
+
+/* starttrace - Start recording; the ring is mapped on first use */
+void starttrace(void)
+{
+    if (tracebuf == NULL)
+    {
+        tracebuf = mmap(NULL, sizeof(struct tracebuf_t), PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (tracebuf == MAP_FAILED)
+        {
+            tracebuf = NULL;
+            printf("trace: %s\n", strerror(errno));
+            return;
+        }
+        tracebuf->start = tracens();
+    }
+    tracing = 1;
+}
+
+/* tracens - The time events are recorded at, in ns on the monotonic clock */
+long long tracens(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/*
+ * traceevent - Record an event of phase ph about process pid of job jid
+ *    (pid 0 for the shell itself); returns the record
+ */
+struct traceev_t *traceevent(int ph, const char *what, pid_t pid, pid_t pgid, int jid, int sig)
+{
+    unsigned long i = __atomic_fetch_add(&tracebuf->head, 1, __ATOMIC_RELAXED);
+    struct traceev_t *ev = &tracebuf->ev[i & (TRACEBUF - 1)];
+
+    ev->ns = tracens();
+    ev->what = what;
+    ev->pid = pid;
+    ev->pgid = pgid;
+    ev->jid = jid;
+    ev->ph = ph;
+    ev->sig = sig;
+    ev->cmd[0] = '\0';
+    return ev;
+}
+
+/*
+ * tracestart - Record that process pid of job jid started running cmd at
+ *    ns (taken before it was launched, so that its span holds its exec)
+ */
+void tracestart(pid_t pid, pid_t pgid, int jid, const char *cmd, long long ns)
+{
+    struct traceev_t *ev = traceevent('B', NULL, pid, pgid, jid, 0);
+    const char *base = strrchr(cmd, '/');
+
+    ev->ns = ns;
+    snprintf(ev->cmd, sizeof(ev->cmd), "%s", (base != NULL) ? base + 1 : cmd);
+}
+
+/* jsonstr - Write str to fp as a JSON string */
+static void jsonstr(FILE *fp, const char *str)
+{
+    putc('"', fp);
+    for (; *str; str++) {
+	if (*str == '"' || *str == '\\')
+	    fprintf(fp, "\\%c", *str);
+	else if ((unsigned char)*str < 0x20)
+	    fprintf(fp, "\\u%04x", *str);
+	else
+	    putc(*str, fp);
+    }
+    putc('"', fp);
+}
+
+/*
+ * dumptrace - Write the recorded events to path as Chrome trace JSON.
+ *    A job is a trace process (pid = its PGID) and each of its processes
+ *    a thread, spanning from start to reap; the shell's own spans are on
+ *    the shell's track. Returns the number of events written, or -1
+ *    after printing an error.
+ */
+long dumptrace(const char *path)
+{
+    unsigned long head, i;
+    struct traceev_t *ev;
+    pid_t pid, pgid;
+    FILE *fp;
+
+    if (tracebuf == NULL)
+    {
+        printf("trace: nothing recorded\n");
+        return -1;
+    }
+    if ((fp = fopen(path, "w")) == NULL)
+    {
+        printf("trace: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    head = tracebuf->head;
+    i = (head > TRACEBUF) ? head - TRACEBUF : 0;
+    fprintf(fp, "{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+            "\"args\":{\"name\":\"tsh\"}}", (int)shellpid);
+    for (; i < head; i++)
+    {
+        ev = &tracebuf->ev[i & (TRACEBUF - 1)];
+        pid = (ev->pid != 0) ? ev->pid : shellpid;
+        pgid = (ev->pid != 0) ? ev->pgid : shellpid;
+        if (ev->what == NULL) // a process started: name its track (and its job's)
+        {
+            if (pid == pgid)
+                fprintf(fp, ",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                        "\"args\":{\"name\":\"job [%d]\"}}", (int)pgid, ev->jid);
+            fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                    "\"args\":{\"name\":", (int)pgid, (int)pid);
+            jsonstr(fp, ev->cmd);
+            fprintf(fp, "}}");
+        }
+        fprintf(fp, ",\n{\"name\":");
+        jsonstr(fp, (ev->what != NULL) ? ev->what : ev->cmd);
+        fprintf(fp, ",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d", ev->ph,
+                (ev->ns - tracebuf->start) / 1000.0, (int)pgid, (int)pid);
+        if (ev->ph == 'i')
+            fprintf(fp, ",\"s\":\"t\"");
+        if (ev->sig != 0)
+            fprintf(fp, ",\"args\":{\"signal\":%d}", ev->sig);
+        putc('}', fp);
+    }
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    if (fclose(fp) == EOF)
+    {
+        printf("trace: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return head - ((head > TRACEBUF) ? head - TRACEBUF : 0);
+}
+
+/* exittrace - Write the trace to the -t file when the shell exits */
+void exittrace(void)
+{
+    if (getpid() == shellpid)
+	dumptrace(tracepath);
+}
+
+/***********************************************
+ * Helper routines that manipulate the job list
+ **********************************************/
+
+/* clearjob - Clear the entries in a job struct */
+void clearjob(struct job_t *job) {
+    job->pid = 0;
+    job->jid = 0;
+    job->state = UNDEF;
+    job->cmdline = NULL;
+    job->pids = NULL;
+    job->nstages = 0;
+    job->nlive = 0;
+    job->termsig = 0;
+    memset(&job->start, 0, sizeof(job->start));
+    memset(&job->resumed, 0, sizeof(job->resumed));
+    job->activens = 0;
+    job->timed = 0;
+    memset(&job->ru, 0, sizeof(job->ru));
+    job->cgroup = NULL;
+    job->hastmodes = 0;
+    job->next = NULL;
+}
+
+/* initjobs - Initialize the job list */
+void initjobs(struct joblist_t *jobs) {
+    memset(jobs, 0, sizeof(*jobs));
+    jobs->jidcap = MINJOBS;
+    jobs->byjid = Realloc(NULL, jobs->jidcap * sizeof(struct job_t *));
+    memset(jobs->byjid, 0, jobs->jidcap * sizeof(struct job_t *));
+    jobs->pidcap = MINJOBS;
+    jobs->bypid = Realloc(NULL, jobs->pidcap * sizeof(struct pident_t));
+    memset(jobs->bypid, 0, jobs->pidcap * sizeof(struct pident_t));
+}
+
+/* maxjid - Returns largest allocated job ID */
+int maxjid(struct joblist_t *jobs) 
+{
+    return jobs->maxjid;
+}
+
+/* pidslot - Return the bypid slot holding pid, or the empty slot ending its probe */
+static struct pident_t *pidslot(struct joblist_t *jobs, pid_t pid)
+{
+    unsigned int mask = jobs->pidcap - 1;
+    unsigned int i = ((unsigned int)pid * 2654435761u) & mask;
+
+    while (jobs->bypid[i].pid != 0 && jobs->bypid[i].pid != pid)
+	i = (i + 1) & mask;
+    return &jobs->bypid[i];
+}
+
+/* pidinsert - Map pid to job, growing (and purging deleted slots) when half full */
+static void pidinsert(struct joblist_t *jobs, pid_t pid, struct job_t *job)
+{
+    struct pident_t *old = jobs->bypid;
+    struct pident_t *ent;
+    int oldcap = jobs->pidcap;
+    int i;
+
+    if (2 * (jobs->pidused + 1) > jobs->pidcap) {
+	while (4 * (jobs->njobs + 1) > jobs->pidcap)
+	    jobs->pidcap *= 2;
+	jobs->bypid = Realloc(NULL, jobs->pidcap * sizeof(struct pident_t));
+	memset(jobs->bypid, 0, jobs->pidcap * sizeof(struct pident_t));
+	jobs->pidused = 0;
+	for (i = 0; i < oldcap; i++)
+	    if (old[i].pid > 0) {
+		*pidslot(jobs, old[i].pid) = old[i];
+		jobs->pidused++;
+	    }
+	free(old);
+    }
+    ent = pidslot(jobs, pid);
+    if (ent->pid == 0)
+	jobs->pidused++;
+    ent->pid = pid;
+    ent->job = job;
+}
+
+/* newjob - Allocate a job with the next JID, in state, running nothing yet */
+static struct job_t *newjob(struct joblist_t *jobs, int state, char *cmdline)
+{
+    struct job_t *job;
+    int jid, i;
+
+    /* Job IDs are handed out above the largest one in use */
+    jid = jobs->maxjid + 1;
+    if (jid >= jobs->jidcap) {
+	jobs->byjid = Realloc(jobs->byjid, 2 * jobs->jidcap * sizeof(struct job_t *));
+	memset(jobs->byjid + jobs->jidcap, 0, jobs->jidcap * sizeof(struct job_t *));
+	jobs->jidcap *= 2;
+    }
+
+    /* Job structs are carved out of slabs so they stay packed together */
+    if (jobs->free == NULL) {
+	job = Realloc(NULL, JOBSLAB * sizeof(struct job_t));
+	for (i = 0; i < JOBSLAB; i++) {
+	    job[i].next = jobs->free;
+	    jobs->free = &job[i];
+	}
+	jobs->nslabs++;
+    }
+    job = jobs->free;
+    jobs->free = job->next;
+    clearjob(job);
+    job->jid = jid;
+    job->state = state;
+    job->cmdline = pool_strdup(&jobs->cmdlines, cmdline);
+
+    jobs->byjid[jid] = job;
+    jobs->maxjid = jid;
+    jobs->njobs++;
+    jobs->nstate[state]++;
+    if (state == FG)
+	jobs->fg = job;
+    return job;
+}
+
+/*
+ * startjob - Record that job, which was not running yet, now runs with
+ *    first stage pid. A QU job becomes BG.
+ */
+void startjob(struct joblist_t *jobs, struct job_t *job, pid_t pid)
+{
+    if (job->state == QU)
+	setjobstate(jobs, job, BG);
+    job->pid = pid;
+    job->nstages = 1;
+    job->nlive = 1;
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+    job->resumed = job->start;
+    pidinsert(jobs, pid, job);
+}
+
+/* addjob - Add a job to the job list */
+int addjob(struct joblist_t *jobs, pid_t pid, int state, char *cmdline) 
+{
+    struct job_t *job;
+    
+    if (pid < 1)
+	return 0;
+
+    job = newjob(jobs, state, cmdline);
+    startjob(jobs, job, pid);
+
+    if(verbose){
+	printf("Added job [%d] %d %s\n", job->jid, job->pid, job->cmdline);
+    }
+    return 1;
+}
+
+/*
+ * addjobpid - Add pid as another stage of the job with JID=jid. pids[]
+ *    is resized to twice nstages whenever nstages reaches a power of 2,
+ *    which also shrinks it once deletejob has taken stages out.
+ */
+int addjobpid(struct joblist_t *jobs, int jid, pid_t pid)
+{
+    struct job_t *job = getjobjid(jobs, jid);
+
+    if (job == NULL || pid < 1)
+	return 0;
+    if ((job->nstages & (job->nstages - 1)) == 0)
+	job->pids = Realloc(job->pids, 2 * job->nstages * sizeof(pid_t));
+    job->pids[0] = job->pid;
+    job->pids[job->nstages++] = pid;
+    job->nlive++;
+    pidinsert(jobs, pid, job);
+    return 1;
+}
+
+/* freejob - Remove job from the job list and recycle it */
+static void freejob(struct joblist_t *jobs, struct job_t *job)
+{
+    jobs->byjid[job->jid] = NULL;
+    /* Each slot skipped here was freed once, so this is amortized O(1) */
+    while (jobs->maxjid > 0 && jobs->byjid[jobs->maxjid] == NULL)
+	jobs->maxjid--;
+    jobs->njobs--;
+    jobs->nstate[job->state]--;
+    if (jobs->fg == job)
+	jobs->fg = NULL;
+
+    pool_free(&jobs->cmdlines, job->cmdline);
+    free(job->pids);
+    if (job->cgroup != NULL)
+	cgremove(job->cgroup);
+    clearjob(job);
+    job->next = jobs->free;
+    jobs->free = job;
+}
+
+/*
+ * deletejob - Delete the stage with PID=pid from the job list. The job
+ *    itself is deleted along with its last remaining stage. A reaped
+ *    stage other than the first leaves pids[], whose last entry takes
+ *    its place, so a parallel job keeps only the tasks still running.
+ */
+int deletejob(struct joblist_t *jobs, pid_t pid) 
+{
+    struct pident_t *ent;
+    struct job_t *job;
+    int i;
+
+    if (pid < 1)
+	return 0;
+
+    ent = pidslot(jobs, pid);
+    if (ent->pid != pid)
+	return 0;
+    job = ent->job;
+    ent->pid = -1;  /* keep probe chains through this slot intact */
+    if (--job->nlive > 0) {
+	for (i = 1; i < job->nstages; i++)
+	    if (job->pids[i] == pid) {
+		job->pids[i] = job->pids[--job->nstages];
+		break;
+	    }
+	return 1;
+    }
+
+    freejob(jobs, job);
+    return 1;
+}
+
+/* queuejob - Add a QU job for cmdline to the end of the queue; returns its JID */
+int queuejob(struct joblist_t *jobs, char *cmdline)
+{
+    struct job_t *job = newjob(jobs, QU, cmdline);
+
+    if (jobs->qtail != NULL)
+	jobs->qtail->next = job;
+    else
+	jobs->qhead = job;
+    jobs->qtail = job;
+    if (verbose)
+	printf("Queued job [%d] %s", job->jid, job->cmdline);
+    return job->jid;
+}
+
+/* unqueuejob - Take a QU job off the queue (it stays on the job list) */
+void unqueuejob(struct joblist_t *jobs, struct job_t *job)
+{
+    struct job_t **pp, *prev = NULL;
+
+    for (pp = &jobs->qhead; *pp != NULL; prev = *pp, pp = &(*pp)->next)
+	if (*pp == job) {
+	    *pp = job->next;
+	    if (jobs->qtail == job)
+		jobs->qtail = prev;
+	    job->next = NULL;
+	    return;
+	}
+}
+
+/* canceljob - Delete a job that has no processes, e.g. a QU job */
+void canceljob(struct joblist_t *jobs, struct job_t *job)
+{
+    unqueuejob(jobs, job);
+    freejob(jobs, job);
+}
+
+/*
+ * admitjobs - Start queued jobs, oldest first, while fewer than
+ *    maxrunning BG jobs are running
+ */
+void admitjobs(void)
+{
+    struct job_t *job;
+
+    while ((jobs.qhead != NULL) && ((maxrunning == 0) || (jobs.nstate[BG] < maxrunning))) {
+	job = jobs.qhead;
+	unqueuejob(&jobs, job);
+	evaljob(job->cmdline, job);
+    }
+}
+
+/*
+ * setjobstate - Change the state of a job, tracking the FG job and the
+ *    time the job has spent running (stopped time doesn't count)
+ */
+void setjobstate(struct joblist_t *jobs, struct job_t *job, int state)
+{
+    if (job == NULL)
+	return;
+    if (state == ST && job->state != ST)
+	job->activens = jobactivens(job);
+    else if (state != ST && job->state == ST)
+	clock_gettime(CLOCK_MONOTONIC, &job->resumed);
+    jobs->nstate[job->state]--;
+    jobs->nstate[state]++;
+    if (jobs->fg == job)
+	jobs->fg = NULL;
+    job->state = state;
+    if (state == FG)
+	jobs->fg = job;
+}
+
+/* fgpid - Return PID of current foreground job, 0 if no such job */
+pid_t fgpid(struct joblist_t *jobs) {
+    return (jobs->fg != NULL) ? jobs->fg->pid : 0;
+}
+
+/* getjobpid  - Find a job (by PID) on the job list */
+struct job_t *getjobpid(struct joblist_t *jobs, pid_t pid) {
+    struct pident_t *ent;
+
+    if (pid < 1)
+	return NULL;
+    ent = pidslot(jobs, pid);
+    return (ent->pid == pid) ? ent->job : NULL;
+}
+
+/* getjobjid  - Find a job (by JID) on the job list */
+struct job_t *getjobjid(struct joblist_t *jobs, int jid) 
+{
+    if (jid < 1 || jid > jobs->maxjid)
+	return NULL;
+    return jobs->byjid[jid];
+}
+
+/* pid2jid - Map process ID to job ID */
+int pid2jid(pid_t pid) 
+{
+    struct job_t *job = getjobpid(&jobs, pid);
+
+    return (job != NULL) ? job->jid : 0;
+}
+
+/*
+ * listjobs - Print the job list. With lflag, jobs that have a cgroup get
+ *    a second line with its memory, CPU and process counts (- if the
+ *    controller isn't available).
+ */
+void listjobs(struct joblist_t *jobs, int lflag) 
+{
+    struct job_t *job;
+    char buf[256];
+    long long mem, usec, npids;
+    FILE *fp;
+    int i;
+    
+    for (i = 1; i <= jobs->maxjid; i++) {
+	if ((job = jobs->byjid[i]) != NULL) {
+	    printf("[%d] (%d) ", job->jid, job->pid);
+	    switch (job->state) {
+		case BG: 
+		    printf("Running ");
+		    break;
+		case FG: 
+		    printf("Foreground ");
+		    break;
+		case ST: 
+		    printf("Stopped ");
+		    break;
+		case QU: 
+		    printf("Queued ");
+		    break;
+	    default:
+		    printf("listjobs: Internal error: job[%d].state=%d ", 
+			   i, job->state);
+	    }
+	    printf("%s", job->cmdline);
+	    if (lflag && job->cgroup != NULL) {
+		mem = usec = npids = -1;
+		sprintf(buf, "%s/memory.current", job->cgroup);
+		if ((fp = fopen(buf, "r")) != NULL) {
+		    if (fscanf(fp, "%lld", &mem) != 1) mem = -1;
+		    fclose(fp);
+		}
+		sprintf(buf, "%s/cpu.stat", job->cgroup);
+		if ((fp = fopen(buf, "r")) != NULL) {
+		    while (fgets(buf, sizeof(buf), fp) != NULL)
+			if (sscanf(buf, "usage_usec %lld", &usec) == 1)
+			    break;
+		    fclose(fp);
+		}
+		sprintf(buf, "%s/cgroup.procs", job->cgroup);
+		if ((fp = fopen(buf, "r")) != NULL) {
+		    for (npids = 0; fgets(buf, sizeof(buf), fp) != NULL; npids++)
+			;
+		    fclose(fp);
+		}
+		printf("    %s: memory ", job->cgroup);
+		if (mem >= 0) printf("%lldK", mem >> 10); else printf("-");
+		printf(", cpu ");
+		if (usec >= 0) printf("%lld.%03llds", usec / 1000000, usec / 1000 % 1000); else printf("-");
+		printf(", %lld processes\n", npids);
+	    }
+	}
+    }
+    if (verbose) {
+	printf("listjobs: %d jobs, %zu bytes in job structs, "
+	       "cmdline pool %zu/%zu bytes in use in %d strings\n",
+	       jobs->njobs, (size_t)jobs->nslabs * JOBSLAB * sizeof(struct job_t),
+	       jobs->cmdlines.inuse, jobs->cmdlines.reserved, jobs->cmdlines.nstrings);
+	printf("listjobs: %lu job events reported, max latency %lld us\n",
+	       evring.nevents, evring.maxlat / 1000);
+    }
+}
+
+/* addrusage - Add the resources in ru to sum; max RSS is a maximum, not a sum */
+void addrusage(struct rusage *sum, const struct rusage *ru)
+{
+    timeradd(&sum->ru_utime, &ru->ru_utime, &sum->ru_utime);
+    timeradd(&sum->ru_stime, &ru->ru_stime, &sum->ru_stime);
+    if (ru->ru_maxrss > sum->ru_maxrss)
+	sum->ru_maxrss = ru->ru_maxrss;
+    sum->ru_nvcsw += ru->ru_nvcsw;
+    sum->ru_nivcsw += ru->ru_nivcsw;
+}
+
+/*
+ * procrusage - Resources used so far by the running (or stopped) process
+ *    pid, from /proc. Returns 0 if pid can't be inspected.
+ */
+int procrusage(pid_t pid, struct rusage *ru)
+{
+    char path[64], line[256];
+    unsigned long utime, stime;
+    long hz = sysconf(_SC_CLK_TCK);
+    char *p;
+    FILE *fp;
+
+    memset(ru, 0, sizeof(*ru));
+
+    /* utime and stime are fields 14 and 15, after the parenthesized comm */
+    sprintf(path, "/proc/%d/stat", (int)pid);
+    if ((fp = fopen(path, "r")) == NULL)
+	return 0;
+    p = fgets(line, sizeof(line), fp) ? strrchr(line, ')') : NULL;
+    fclose(fp);
+    if (p == NULL ||
+	sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+	       &utime, &stime) != 2)
+	return 0;
+    ru->ru_utime.tv_sec = utime / hz;
+    ru->ru_utime.tv_usec = (utime % hz) * 1000000 / hz;
+    ru->ru_stime.tv_sec = stime / hz;
+    ru->ru_stime.tv_usec = (stime % hz) * 1000000 / hz;
+
+    sprintf(path, "/proc/%d/status", (int)pid);
+    if ((fp = fopen(path, "r")) == NULL)
+	return 1;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+	if (sscanf(line, "VmHWM: %ld", &ru->ru_maxrss) == 1)
+	    continue;
+	if (sscanf(line, "voluntary_ctxt_switches: %ld", &ru->ru_nvcsw) == 1)
+	    continue;
+	sscanf(line, "nonvoluntary_ctxt_switches: %ld", &ru->ru_nivcsw);
+    }
+    fclose(fp);
+    return 1;
+}
+
+/*
+ * jobrusage - Resources used by a job: its reaped stages plus what the
+ *    stages still running have used so far
+ */
+void jobrusage(struct joblist_t *jobs, struct job_t *job, struct rusage *ru)
+{
+    struct rusage live;
+    pid_t pid;
+    int i;
+
+    *ru = job->ru;
+    for (i = 0; i < job->nstages; i++) {
+	pid = (job->pids != NULL) ? job->pids[i] : job->pid;
+	if (getjobpid(jobs, pid) == job && procrusage(pid, &live))
+	    addrusage(ru, &live);
+    }
+}
+
+/* printjobstat - Print the wall time and resources used by a job */
+void printjobstat(struct joblist_t *jobs, struct job_t *job)
+{
+    struct jobreport_t rep;
+
+    if (job->state == QU) {
+	printf("[%d] (%d) queued %s", job->jid, job->pid, job->cmdline);
+	return;
+    }
+    fillreport(jobs, job, &rep);
+    printstat(job->jid, job->pid, &rep);
+}
+
+/* fillreport - Take the times and resources a job's reports show */
+void fillreport(struct joblist_t *jobs, struct job_t *job, struct jobreport_t *rep)
+{
+    struct timespec now;
+    struct rusage ru;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    jobrusage(jobs, job, &ru);
+    rep->cmdline = job->cmdline;
+    rep->wallns = (now.tv_sec - job->start.tv_sec) * 1000000000LL +
+	(now.tv_nsec - job->start.tv_nsec);
+    rep->activens = jobactivens(job);
+    rep->utime = ru.ru_utime;
+    rep->stime = ru.ru_stime;
+    rep->maxrss = ru.ru_maxrss;
+    rep->nvcsw = ru.ru_nvcsw;
+    rep->nivcsw = ru.ru_nivcsw;
+    rep->show = REP_STAT;
+}
+
+/* printstat - Print the jobstat line of job jid (PGID pid) */
+void printstat(int jid, pid_t pid, struct jobreport_t *rep)
+{
+    long wall = rep->wallns / 1000000;
+
+    printf("[%d] (%d) wall %ld.%03lds user %ld.%03lds sys %ld.%03lds "
+	   "maxrss %ldKB csw %ld/%ld %s",
+	   jid, pid, wall / 1000, wall % 1000,
+	   (long)rep->utime.tv_sec, (long)rep->utime.tv_usec / 1000,
+	   (long)rep->stime.tv_sec, (long)rep->stime.tv_usec / 1000,
+	   rep->maxrss, rep->nvcsw, rep->nivcsw, rep->cmdline);
+}
+
+/* jobactivens - Nanoseconds the job has spent running (FG or BG) */
+long long jobactivens(struct job_t *job)
+{
+    struct timespec now;
+
+    if (job->state == ST || job->state == QU)
+	return job->activens;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return job->activens + (now.tv_sec - job->resumed.tv_sec) * 1000000000LL +
+	(now.tv_nsec - job->resumed.tv_nsec);
+}
+
+/* printtimes - Print the report of the time keyword */
+void printtimes(long long realns, struct timeval *utime, struct timeval *stime)
+{
+    printf("real\t%lld.%09llds\n", realns / 1000000000, realns % 1000000000);
+    printf("user\t%ld.%06ld000s\n", (long)utime->tv_sec, (long)utime->tv_usec);
+    printf("sys\t%ld.%06ld000s\n", (long)stime->tv_sec, (long)stime->tv_usec);
+}
+
+/* strclass - Size class of a pool block holding len bytes, NSTRCLASS if too big */
+static int strclass(size_t len)
+{
+    int class = 0;
+    size_t size = MINSTR;
+
+    while (size < len && class < NSTRCLASS) {
+	size <<= 1;
+	class++;
+    }
+    return class;
+}
+
+/*
+ * pool_strdup - Copy str into the pool. Blocks are power-of-2 sized and
+ *    recycled per size class; strings longer than MAXLINE use malloc.
+ */
+char *pool_strdup(struct strpool_t *pool, const char *str)
+{
+    size_t len = strlen(str) + 1;
+    int class = strclass(len);
+    size_t size = (size_t)MINSTR << class;
+    char *block;
+
+    if (class == NSTRCLASS) {
+	block = Realloc(NULL, len);
+	size = len;
+    }
+    else if ((block = pool->free[class]) != NULL) {
+	memcpy(&pool->free[class], block, sizeof(char *));
+    }
+    else {
+	if (pool->chunkleft < size) {
+	    /* the tail of the old chunk is given up; it is < MAXLINE bytes */
+	    pool->chunk = Realloc(NULL, POOLCHUNK);
+	    pool->chunkleft = POOLCHUNK;
+	    pool->reserved += POOLCHUNK;
+	}
+	block = pool->chunk;
+	pool->chunk += size;
+	pool->chunkleft -= size;
+    }
+    memcpy(block, str, len);
+    pool->inuse += size;
+    pool->nstrings++;
+    return block;
+}
+
+/* pool_free - Return a string from pool_strdup to the pool */
+void pool_free(struct strpool_t *pool, char *str)
+{
+    size_t len;
+    int class;
+
+    if (str == NULL)
+	return;
+    len = strlen(str) + 1;
+    class = strclass(len);
+    if (class == NSTRCLASS) {
+	pool->inuse -= len;
+	free(str);
+    }
+    else {
+	memcpy(str, &pool->free[class], sizeof(char *));
+	pool->free[class] = str;
+	pool->inuse -= (size_t)MINSTR << class;
+    }
+    pool->nstrings--;
+}
+/******************************
+ * end job list helper routines
+ ******************************/
+
+
+/**************************
+ * PATH lookup cache routines
+ **************************/
+
+/* pathhash - FNV-1a hash of a command name */
+static unsigned int pathhash(const char *name)
+{
+    unsigned int h = 2166136261u;
+
+    while (*name)
+	h = (h ^ (unsigned char)*name++) * 16777619u;
+    return h;
+}
+
+/* isexec - Is path an executable regular file? */
+static int isexec(const char *path)
+{
+    struct stat sb;
+
+    return (stat(path, &sb) == 0) && S_ISREG(sb.st_mode) && (access(path, X_OK) == 0);
+}
+
+/*
+ * findpath - Resolve a command name to the file execv should run, NULL
+ *    if there is none. Names with a slash are used as they are; others
+ *    are searched for in PATH once and then answered from the cache.
+ *    The cache is dropped whenever PATH changes.
+ */
+char *findpath(char *name)
+{
+    struct pathent_t *ent, **bucket, **old;
+    char *pathvar = getenv("PATH");
+    char *dir, *end, *file;
+    size_t dlen, nlen;
+    int oldn, i;
+
+    if (strchr(name, '/') != NULL)
+	return isexec(name) ? name : NULL;
+
+    if (pathvar == NULL)
+	pathvar = "/bin:/usr/bin";  /* same default as execvp */
+    if (pathcache.pathvar == NULL || strcmp(pathcache.pathvar, pathvar) != 0) {
+	clearpaths();
+	pathcache.pathvar = strdup(pathvar);
+    }
+
+    if (pathcache.nbuckets > 0) {
+	bucket = &pathcache.buckets[pathhash(name) & (pathcache.nbuckets - 1)];
+	for (ent = *bucket; ent != NULL; ent = ent->next)
+	    if (strcmp(ent->name, name) == 0) {
+		ent->hits++;
+		pathcache.hits++;
+		return ent->path;
+	    }
+    }
+
+    /* Search each PATH directory; an empty one means the current directory */
+    pathcache.misses++;
+    nlen = strlen(name);
+    file = NULL;
+    for (dir = pathvar; ; dir = end + 1) {
+	end = strchr(dir, ':');
+	dlen = (end != NULL) ? (size_t)(end - dir) : strlen(dir);
+	file = Realloc(NULL, dlen + nlen + 3);
+	if (dlen == 0)
+	    sprintf(file, "./%s", name);
+	else
+	    sprintf(file, "%.*s/%s", (int)dlen, dir, name);
+	if (isexec(file))
+	    break;
+	free(file);
+	file = NULL;
+	if (end == NULL)
+	    break;
+    }
+    if (file == NULL)
+	return NULL;
+
+    /* Remember it, doubling the table when it gets full */
+    if (pathcache.nentries >= pathcache.nbuckets) {
+	old = pathcache.buckets;
+	oldn = pathcache.nbuckets;
+	pathcache.nbuckets = (oldn > 0) ? 2 * oldn : MINJOBS;
+	pathcache.buckets = Realloc(NULL, pathcache.nbuckets * sizeof(struct pathent_t *));
+	memset(pathcache.buckets, 0, pathcache.nbuckets * sizeof(struct pathent_t *));
+	for (i = 0; i < oldn; i++)
+	    while ((ent = old[i]) != NULL) {
+		old[i] = ent->next;
+		bucket = &pathcache.buckets[pathhash(ent->name) & (pathcache.nbuckets - 1)];
+		ent->next = *bucket;
+		*bucket = ent;
+	    }
+	free(old);
+    }
+    ent = Realloc(NULL, sizeof(struct pathent_t));
+    ent->name = strdup(name);
+    ent->path = file;
+    ent->hits = 1;
+    bucket = &pathcache.buckets[pathhash(name) & (pathcache.nbuckets - 1)];
+    ent->next = *bucket;
+    *bucket = ent;
+    pathcache.nentries++;
+    return file;
+}
+
+/* forgetpath - Drop the cached lookup of name, if any */
+void forgetpath(char *name)
+{
+    struct pathent_t *ent, **prev;
+
+    if (pathcache.nbuckets == 0)
+	return;
+    prev = &pathcache.buckets[pathhash(name) & (pathcache.nbuckets - 1)];
+    for (ent = *prev; ent != NULL; prev = &ent->next, ent = ent->next)
+	if (strcmp(ent->name, name) == 0) {
+	    *prev = ent->next;
+	    free(ent->name);
+	    free(ent->path);
+	    free(ent);
+	    pathcache.nentries--;
+	    return;
+	}
+}
+
+/* clearpaths - Drop every cached lookup */
+void clearpaths(void)
+{
+    struct pathent_t *ent;
+    int i;
+
+    for (i = 0; i < pathcache.nbuckets; i++)
+	while ((ent = pathcache.buckets[i]) != NULL) {
+	    pathcache.buckets[i] = ent->next;
+	    free(ent->name);
+	    free(ent->path);
+	    free(ent);
+	}
+    pathcache.nentries = 0;
+    free(pathcache.pathvar);
+    pathcache.pathvar = NULL;
+}
+
+/******************
+ * cgroup routines
+ ******************/
+
+/* cgwrite - Write val to the file name in the cgroup directory dir */
+static int cgwrite(const char *dir, const char *name, const char *val)
+{
+    char path[PATH_MAX];
+    int fd, n;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if ((fd = open(path, O_WRONLY | O_CLOEXEC)) < 0)
+	return -1;
+    n = write(fd, val, strlen(val));
+    close(fd);
+    return (n < 0) ? -1 : 0;
+}
+
+/*
+ * cgbase - The directory job cgroups are made in: tsh-<pid> under the
+ *    shell's own cgroup (or under $TSH_CGROUP), made on first use with
+ *    the cpu, memory and pids controllers enabled as far as we may.
+ *    Returns NULL after printing why if cgroup v2 isn't usable.
+ */
+char *cgbase(void)
+{
+    char line[PATH_MAX], mnt[PATH_MAX], type[32], self[PATH_MAX];
+    char dir[PATH_MAX], base[PATH_MAX + 32];
+    static char *ctls[] = {"+cpu", "+memory", "+pids", NULL};
+    struct statfs fs;
+    char *env;
+    FILE *fp;
+    int i;
+
+    if (cglimits.base != NULL)
+	return cglimits.base;
+
+    if ((env = getenv("TSH_CGROUP")) != NULL)
+	snprintf(dir, sizeof(dir), "%s", env);
+    else {
+	/* the cgroup2 mount point, and the shell's cgroup ("0::/path") in it */
+	mnt[0] = self[0] = '\0';
+	if ((fp = fopen("/proc/self/mounts", "r")) != NULL) {
+	    while (fgets(line, sizeof(line), fp) != NULL)
+		if (sscanf(line, "%*s %4095s %31s", mnt, type) == 2 && strcmp(type, "cgroup2") == 0)
+		    break;
+		else
+		    mnt[0] = '\0';
+	    fclose(fp);
+	}
+	if ((fp = fopen("/proc/self/cgroup", "r")) != NULL) {
+	    while (fgets(line, sizeof(line), fp) != NULL)
+		if (strncmp(line, "0::", 3) == 0) {
+		    line[strcspn(line, "\n")] = '\0';
+		    strcpy(self, line + 3);
+		}
+	    fclose(fp);
+	}
+	if (mnt[0] == '\0' || self[0] == '\0') {
+	    printf("cgroup: no cgroup v2 hierarchy, jobs run without limits\n");
+	    return NULL;
+	}
+	snprintf(dir, sizeof(dir), "%s%s", mnt, (strcmp(self, "/") == 0) ? "" : self);
+    }
+
+    /* $TSH_CGROUP may name any directory; jobs could not be moved into
+     * directories made there */
+    if (statfs(dir, &fs) < 0 || fs.f_type != CGROUP2_SUPER_MAGIC) {
+	printf("cgroup: %s: not a cgroup v2 directory, jobs run without limits\n", dir);
+	return NULL;
+    }
+
+    /* Enabling controllers in a cgroup that has processes fails; the
+     * ones already delegated to dir are what we get then */
+    for (i = 0; ctls[i] != NULL; i++)
+	cgwrite(dir, "cgroup.subtree_control", ctls[i]);
+    snprintf(base, sizeof(base), "%s/tsh-%d", dir, (int)getpid());
+    if (mkdir(base, 0755) < 0 && errno != EEXIST) {
+	printf("cgroup: %s: %s, jobs run without limits\n", base, strerror(errno));
+	return NULL;
+    }
+    for (i = 0; ctls[i] != NULL; i++)
+	cgwrite(base, "cgroup.subtree_control", ctls[i]);
+    cglimits.base = strdup(base);
+    atexit(cgcleanup);
+    return cglimits.base;
+}
+
+/*
+ * cgcreate - Make the cgroup for job jid with the current limits and
+ *    return its (malloc'd) path, or NULL if that isn't possible. Limits
+ *    whose controller is missing are left out.
+ */
+char *cgcreate(int jid)
+{
+    char path[PATH_MAX];
+
+    if (cgbase() == NULL)
+	return NULL;
+    snprintf(path, sizeof(path), "%s/job%d", cglimits.base, jid);
+    if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+	printf("cgroup: %s: %s\n", path, strerror(errno));
+	return NULL;
+    }
+    if (cglimits.cpu[0])
+	cgwrite(path, "cpu.max", cglimits.cpu);
+    if (cglimits.mem[0])
+	cgwrite(path, "memory.max", cglimits.mem);
+    if (cglimits.pids[0])
+	cgwrite(path, "pids.max", cglimits.pids);
+    return strdup(path);
+}
+
+/* cgmove - Move process pid (0 = the caller) into cgroup */
+int cgmove(const char *cgroup, pid_t pid)
+{
+    char val[16];
+
+    sprintf(val, "%d", (int)pid);
+    return cgwrite(cgroup, "cgroup.procs", val);
+}
+
+/*
+ * cgremove - Remove a job's cgroup and free the path. The directory
+ *    stays if processes that left the job (e.g. daemons) still use it.
+ */
+void cgremove(char *cgroup)
+{
+    rmdir(cgroup);
+    free(cgroup);
+}
+
+/*
+ * cgcleanup - Remove the shell's cgroup directory at exit (not when a
+ *    forked child exits; the shell may still need it)
+ */
+void cgcleanup(void)
+{
+    if (cglimits.base != NULL && getpid() == shellpid)
+	rmdir(cglimits.base);
+}
+
+/******************
+ * History routines
+ ******************/
+
+/*
+ * The history is an append-only log of command lines, one per line, and
+ * an index file (log.idx) holding the offset of each line as a 64-bit
+ * number. Both are only ever appended to, under an flock of the log, so
+ * several shells can share them. They are mapped into memory when
+ * entries are needed, so nothing is parsed at startup; !n is a lookup in
+ * the index, and !prefix a binary search of the entries sorted by text.
+ */
+
+/*
+ * histrepair - Index the lines at the end of the log that have no index
+ *    entry, and end a line that was cut short. Both happen only when a
+ *    shell died between or during its appends. Called with the lock held.
+ */
+static void histrepair(void)
+{
+    char buf[INBUFSIZE];
+    uint64_t offs[512];         /* index entries to append */
+    uint64_t start = 0, off;    /* start of the current line, read position */
+    struct stat lsb, isb;
+    int skip, noffs = 0;
+    ssize_t len, i;
+
+    if (fstat(hist.idxfd, &isb) < 0 || fstat(hist.logfd, &lsb) < 0)
+	return;
+    if (isb.st_size % sizeof(uint64_t) != 0 &&
+	ftruncate(hist.idxfd, isb.st_size - isb.st_size % sizeof(uint64_t)) < 0)
+	return;
+    isb.st_size -= isb.st_size % sizeof(uint64_t);
+
+    /* Start at the last indexed line, which needs no entry */
+    skip = (isb.st_size > 0);
+    if (skip && pread(hist.idxfd, &start, sizeof(start), isb.st_size - sizeof(start)) != sizeof(start))
+	return;
+    for (off = start; off < (uint64_t)lsb.st_size; off += len) {
+	if ((len = pread(hist.logfd, buf, sizeof(buf), off)) <= 0)
+	    break;
+	for (i = 0; i < len; i++) {
+	    if (buf[i] != '\n')
+		continue;
+	    if (!skip)
+		offs[noffs++] = start;
+	    skip = 0;
+	    start = off + i + 1;
+	    if (noffs == 512) {
+		if (write(hist.idxfd, offs, sizeof(offs)) < 0)
+		    return;
+		noffs = 0;
+	    }
+	}
+    }
+    if (start < off) {          /* a line without its newline */
+	if (write(hist.logfd, "\n", 1) < 0)
+	    return;
+	if (!skip)
+	    offs[noffs++] = start;
+    }
+    if (noffs > 0 && write(hist.idxfd, offs, noffs * sizeof(offs[0])) < 0)
+	return;
+}
+
+/*
+ * inithistory - Keep the history in the log path (and path.idx). Only
+ *    the tail of the log is looked at, to repair an interrupted append.
+ */
+void inithistory(const char *path)
+{
+    char idxpath[PATH_MAX + 8];
+
+    snprintf(idxpath, sizeof(idxpath), "%s.idx", path);
+    if ((hist.logfd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600)) < 0) {
+	printf("history: %s: %s\n", path, strerror(errno));
+	return;
+    }
+    if ((hist.idxfd = open(idxpath, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600)) < 0) {
+	printf("history: %s: %s\n", idxpath, strerror(errno));
+	close(hist.logfd);
+	return;
+    }
+    flock(hist.logfd, LOCK_EX);
+    histrepair();
+    flock(hist.logfd, LOCK_UN);
+    hist.on = 1;
+}
+
+/*
+ * histadd - Append cmdline to the history unless it is blank. The log
+ *    line goes first, so an index entry always points at a whole line.
+ */
+void histadd(const char *cmdline)
+{
+    size_t len = strcspn(cmdline, "\n");
+    struct stat sb;
+    uint64_t off;
+
+    if (!hist.on || strspn(cmdline, " \t") >= len)
+	return;
+    flock(hist.logfd, LOCK_EX);
+    if (fstat(hist.logfd, &sb) == 0) {
+	off = sb.st_size;
+	if (write(hist.logfd, cmdline, len + 1) == (ssize_t)(len + 1) &&
+	    write(hist.idxfd, &off, sizeof(off)) < 0)
+	    printf("history: %s\n", strerror(errno));
+    }
+    flock(hist.logfd, LOCK_UN);
+}
+
+/*
+ * histsync - Map all entries, including those other shells appended
+ *    since the last call
+ */
+void histsync(void)
+{
+    struct stat isb, lsb;
+    void *idx, *log;
+    size_t n;
+
+    /* The index first: the lines it points to are in the log by then */
+    if (fstat(hist.idxfd, &isb) < 0 || fstat(hist.logfd, &lsb) < 0)
+	return;
+    if ((n = isb.st_size / sizeof(uint64_t)) == hist.n)
+	return;
+    idx = mmap(NULL, n * sizeof(uint64_t), PROT_READ, MAP_SHARED, hist.idxfd, 0);
+    log = mmap(NULL, lsb.st_size, PROT_READ, MAP_SHARED, hist.logfd, 0);
+    if (idx == MAP_FAILED || log == MAP_FAILED) {
+	if (idx != MAP_FAILED)
+	    munmap(idx, n * sizeof(uint64_t));
+	if (log != MAP_FAILED)
+	    munmap(log, lsb.st_size);
+	return;
+    }
+    if (hist.n > 0) {
+	munmap(hist.idx, hist.n * sizeof(uint64_t));
+	munmap(hist.log, hist.loglen);
+    }
+    hist.idx = idx;
+    hist.log = log;
+    hist.n = n;
+    hist.loglen = lsb.st_size;
+}
+
+/* histline - Entry i (from 0) and, in *len, its length without the newline */
+char *histline(size_t i, size_t *len)
+{
+    char *line, *nl;
+
+    if (hist.idx[i] >= hist.loglen) {   /* a damaged index */
+	*len = 0;
+	return "";
+    }
+    line = hist.log + hist.idx[i];
+    nl = memchr(line, '\n', hist.log + hist.loglen - line);
+    *len = (nl != NULL) ? (size_t)(nl - line) : (size_t)(hist.log + hist.loglen - line);
+    return line;
+}
+
+/* histcmp - Order entries by text, for qsort */
+static int histcmp(const void *a, const void *b)
+{
+    size_t la, lb;
+    char *sa = histline(*(const int *)a, &la);
+    char *sb = histline(*(const int *)b, &lb);
+    int c = memcmp(sa, sb, (la < lb) ? la : lb);
+
+    return (c != 0) ? c : (la > lb) - (la < lb);
+}
+
+/* histprefix - Compare entry i with the k-byte prefix: 0 if it starts with it */
+static int histprefix(int i, const char *prefix, size_t k)
+{
+    size_t len;
+    char *line = histline(i, &len);
+    int c = memcmp(line, prefix, (len < k) ? len : k);
+
+    return (c != 0) ? c : (len < k) ? -1 : 0;
+}
+
+/*
+ * histsort - Sort all mapped entries by text, and build maxtree over the
+ *    sorted order so the latest of a range of entries is found in
+ *    O(log n). Entries with the same prefix form such a range.
+ */
+static void histsort(void)
+{
+    size_t i;
+
+    hist.sorted = Realloc(hist.sorted, (hist.n + 1) * sizeof(int));
+    for (i = 0; i < hist.n; i++)
+	hist.sorted[i] = i;
+    qsort(hist.sorted, hist.n, sizeof(int), histcmp);
+    for (hist.treecap = 1; hist.treecap < hist.n; hist.treecap *= 2)
+	;
+    hist.maxtree = Realloc(hist.maxtree, 2 * hist.treecap * sizeof(int));
+    for (i = 0; i < hist.treecap; i++)
+	hist.maxtree[hist.treecap + i] = (i < hist.n) ? hist.sorted[i] : -1;
+    for (i = hist.treecap - 1; i > 0; i--)
+	hist.maxtree[i] = (hist.maxtree[2 * i] > hist.maxtree[2 * i + 1]) ?
+	    hist.maxtree[2 * i] : hist.maxtree[2 * i + 1];
+    hist.nsorted = hist.n;
+}
+
+/*
+ * histfind - The latest entry that starts with the k bytes of prefix,
+ *    or -1. Entries added since the last sort are scanned (newest
+ *    first); the sorted ones are binary searched.
+ */
+static long histfind(const char *prefix, size_t k)
+{
+    size_t lo, hi, mid, end, i;
+    int best = -1, m;
+
+    if (hist.n - hist.nsorted > HISTTAIL)
+	histsort();
+    for (i = hist.n; i > hist.nsorted; i--)
+	if (histprefix(i - 1, prefix, k) == 0)
+	    return i - 1;
+
+    /* [lo, end) are the sorted entries starting with prefix */
+    for (lo = 0, hi = hist.nsorted; lo < hi; ) {
+	mid = (lo + hi) / 2;
+	if (histprefix(hist.sorted[mid], prefix, k) < 0)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    for (hi = hist.nsorted, end = lo; end < hi; ) {
+	mid = (end + hi) / 2;
+	if (histprefix(hist.sorted[mid], prefix, k) <= 0)
+	    end = mid + 1;
+	else
+	    hi = mid;
+    }
+
+    /* The latest of them */
+    for (lo += hist.treecap, end += hist.treecap; lo < end; lo /= 2, end /= 2) {
+	if ((lo & 1) && (m = hist.maxtree[lo++]) > best)
+	    best = m;
+	if ((end & 1) && (m = hist.maxtree[--end]) > best)
+	    best = m;
+    }
+    return best;
+}
+
+/*
+ * histexpand - If cmdline starts with a history reference, return it
+ *    with the reference replaced by that entry (valid until the next
+ *    call), after echoing it as bash does; else return cmdline. The
+ *    references are !! (the last line), !n (line n), !-n (the nth last
+ *    line) and !prefix (the last line starting with prefix). Returns
+ *    NULL after printing an error if there is no such line.
+ */
+char *histexpand(char *cmdline)
+{
+    static char *buf = NULL;    /* the expanded line */
+    static size_t cap = 0;
+    char *p = cmdline + strspn(cmdline, " \t"), *end;
+    size_t len, need;
+    long e;
+    char *line;
+
+    if (!hist.on || p[0] != '!' || strchr(" \t\n=(", p[1]) != NULL)
+	return cmdline;
+    histsync();
+    if (p[1] == '!') {
+	e = hist.n - 1;
+	end = p + 2;
+    }
+    else if (isdigit((unsigned char)p[1]) || (p[1] == '-' && isdigit((unsigned char)p[2]))) {
+	e = strtol(p + 1, &end, 10);
+	e = (e < 0) ? (long)hist.n + e : e - 1;
+    }
+    else {
+	end = p + 1 + strcspn(p + 1, " \t\n");
+	e = histfind(p + 1, end - p - 1);
+    }
+    if (e < 0 || e >= (long)hist.n) {
+	printf("%.*s: event not found\n", (int)(end - p), p);
+	return NULL;
+    }
+
+    line = histline(e, &len);
+    need = (p - cmdline) + len + strlen(end) + 1;
+    if (need > cap) {
+	cap = (need > MAXLINE) ? need : MAXLINE;
+	buf = Realloc(buf, cap);
+    }
+    sprintf(buf, "%.*s%.*s%s", (int)(p - cmdline), cmdline, (int)len, line, end);
+    printf("%s", buf);
+    return buf;
+}
+
+/**********************
+ * Line editor routines
+ **********************/
+
+/*
+ * When someone is typing at us, lines are read by a small editor that
+ * puts the terminal in raw mode for as long as the line is edited, and
+ * back in the mode we started in before the line is run, so FG jobs see
+ * a normal terminal. In raw mode ctrl-c and ctrl-z are keys, not signals.
+ */
+
+/*
+ * initeditor - Edit the lines read from the terminal fd; remember its
+ *    modes to return to
+ */
+void initeditor(int fd)
+{
+    if (tcgetattr(fd, &editor.cooked) < 0)
+	return;
+    editor.raw = editor.cooked;
+    editor.raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    editor.raw.c_cflag |= CS8;
+    editor.raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    editor.raw.c_cc[VMIN] = 1;
+    editor.raw.c_cc[VTIME] = 0;
+    editor.on = 1;
+    editor.prompt = prompt;
+    editor.cap = MAXLINE;
+    editor.buf = Realloc(NULL, editor.cap);
+    atexit(cookedmode);
+}
+
+/* cookedmode - Give the terminal back the modes it had when we started */
+void cookedmode(void)
+{
+    if (editor.on && getpid() == shellpid)
+	tcsetattr(input.fd, TCSADRAIN, &editor.cooked);
+}
+
+/* ttywrite - Write len bytes to the terminal, unbuffered */
+static void ttywrite(const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0 && ((n = write(STDOUT_FILENO, buf, len)) > 0 || errno == EINTR))
+	if (n > 0) {
+	    buf += n;
+	    len -= n;
+	}
+}
+
+/*
+ * readkey - The next byte typed, or -1 at end of file. Signals are
+ *    dispatched while waiting, as for any input.
+ */
+static int readkey(void)
+{
+    if (input.pos == input.len) {
+	if (input.eof)
+	    return -1;
+	fillinput();
+	if (input.pos == input.len)
+	    return -1;
+    }
+    return (unsigned char)input.buf[input.pos++];
+}
+
+/*
+ * refreshline - Redraw the prompt and the line, scrolled sideways so the
+ *    cursor is on screen
+ */
+static void refreshline(void)
+{
+    char seq[64];
+    const char *p = editor.prompt;
+    size_t plen = strlen(p), pos = editor.pos, len = editor.len;
+    char *buf = editor.buf;
+    int n;
+
+    while (plen + pos >= editor.cols && pos > 0) {
+	buf++;
+	len--;
+	pos--;
+    }
+    while (plen + len > editor.cols && len > 0)
+	len--;
+    ttywrite("\r", 1);
+    ttywrite(p, plen);
+    ttywrite(buf, len);
+    n = snprintf(seq, sizeof(seq), "\x1b[0K\r\x1b[%dC", (int)(pos + plen));
+    ttywrite(seq, (pos + plen > 0) ? (size_t)n : 5);
+}
+
+/* editinsert - Insert len bytes at the cursor */
+static void editinsert(const char *s, size_t len)
+{
+    if (editor.len + len + 2 > editor.cap) {
+	editor.cap = 2 * (editor.len + len + 2);
+	editor.buf = Realloc(editor.buf, editor.cap);
+    }
+    memmove(editor.buf + editor.pos + len, editor.buf + editor.pos, editor.len - editor.pos);
+    memcpy(editor.buf + editor.pos, s, len);
+    editor.pos += len;
+    editor.len += len;
+}
+
+/* editdelete - Delete the len bytes at from */
+static void editdelete(size_t from, size_t len)
+{
+    memmove(editor.buf + from, editor.buf + from + len, editor.len - from - len);
+    editor.len -= len;
+    if (editor.pos > from + len)
+	editor.pos -= len;
+    else if (editor.pos > from)
+	editor.pos = from;
+}
+
+/* editset - Replace the line with len bytes of s, cursor at the end */
+static void editset(const char *s, size_t len)
+{
+    editor.len = editor.pos = 0;
+    editinsert(s, len);
+}
+
+/*
+ * edithistory - Show history entry e (hist.n is the line being typed,
+ *    kept in editor.saved meanwhile)
+ */
+static void edithistory(size_t e)
+{
+    size_t len;
+    char *line;
+
+    if (editor.histpos == hist.n) {
+	free(editor.saved);
+	editor.saved = strndup(editor.buf, editor.len);
+    }
+    editor.histpos = e;
+    if (e == hist.n)
+	editset(editor.saved, strlen(editor.saved));
+    else {
+	line = histline(e, &len);
+	editset(line, len);
+    }
+}
+
+/*
+ * searchhistory - The latest entry before from containing the len bytes
+ *    of q, or -1
+ */
+static long searchhistory(long from, const char *q, size_t len)
+{
+    size_t n;
+    char *line;
+
+    while (--from >= 0) {
+	line = histline(from, &n);
+	if (memmem(line, n, q, len) != NULL)
+	    return from;
+    }
+    return -1;
+}
+
+/*
+ * editsearch - Ctrl-R: search the history backwards for what is typed
+ *    next, showing the latest match. Ctrl-R again finds an older one,
+ *    ctrl-g or ctrl-c gives up, and any other key takes the match as the
+ *    line and is then handled as usual. Returns that key.
+ */
+static int editsearch(void)
+{
+    char q[256], shown[512];
+    size_t qlen = 0, len = 0;
+    long match = -1, found;
+    char *line = "";
+    int c, n;
+
+    while (1) {
+	n = snprintf(shown, sizeof(shown), "\r(reverse-i-search)`%.*s': %.*s\x1b[0K",
+		     (int)qlen, q, (int)((len < 200) ? len : 200), line);
+	ttywrite(shown, (n < (int)sizeof(shown)) ? (size_t)n : sizeof(shown) - 1);
+	c = readkey();
+	if (c == CTRLKEY('R'))
+	    found = searchhistory((match < 0) ? (long)hist.n : match, q, qlen);
+	else if (c == 127 || c == CTRLKEY('H')) {
+	    if (qlen > 0)
+		qlen--;
+	    found = searchhistory(hist.n, q, qlen);
+	}
+	else if (c >= ' ' && c < 127 && qlen < sizeof(q)) {
+	    q[qlen++] = c;
+	    found = searchhistory((match < 0) ? (long)hist.n : match + 1, q, qlen);
+	}
+	else
+	    break;
+	if (found >= 0 && qlen > 0) {
+	    match = found;
+	    line = histline(match, &len);
+	}
+	else if (qlen == 0) {
+	    match = -1;
+	    line = "";
+	    len = 0;
+	}
+    }
+    if (c == CTRLKEY('G') || c == CTRLKEY('C'))
+	return 0;
+    if (match >= 0) {
+	editor.histpos = hist.n;
+	editset(line, len);
+    }
+    return c;
+}
+
+/*
+ * editline - Read a line with the editor: return it with a newline, valid
+ *    until the next call, or NULL at end of file. Keys: left/right,
+ *    home/end, ctrl-a/e/b/f move; backspace, delete, ctrl-d/k/u/w delete;
+ *    up/down and ctrl-p/n walk the history; ctrl-r searches it; tab
+ *    completes; ctrl-c starts over; ctrl-d on an empty line ends input.
+ */
+char *editline(void)
+{
+    struct winsize ws;
+    int c, tabs = 0;
+    size_t i;
+    char ch;
+
+    dispatch_signals();
+    fflush(stdout);
+    editor.cols = (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) ? ws.ws_col : 80;
+    editor.len = editor.pos = 0;
+    if (hist.on)
+	histsync();
+    editor.histpos = hist.n;
+    tcsetattr(input.fd, TCSADRAIN, &editor.raw);
+    startcompleter();
+    refreshline();
+
+    while ((c = readkey()) >= 0) {
+	if (c == CTRLKEY('R') && hist.on)
+	    c = editsearch();
+	tabs = (c == '\t') ? tabs + 1 : 0;
+
+	if (c == '\x1b') {      /* escape sequence: map it to a control key */
+	    c = readkey();
+	    if (c == '[' || c == 'O') {
+		c = readkey();
+		if (c >= '0' && c <= '9') {
+		    if (readkey() != '~')
+			c = 0;
+		    else
+			c = (c == '3') ? KEY_DELETE : (c == '1' || c == '7') ? CTRLKEY('A') :
+			    (c == '4' || c == '8') ? CTRLKEY('E') : 0;
+		}
+		else
+		    c = (c == 'A') ? CTRLKEY('P') : (c == 'B') ? CTRLKEY('N') : (c == 'C') ? CTRLKEY('F') :
+			(c == 'D') ? CTRLKEY('B') : (c == 'H') ? CTRLKEY('A') : (c == 'F') ? CTRLKEY('E') : 0;
+	    }
+	    else
+		c = 0;
+	}
+
+	switch (c) {
+	case '\r':
+	case '\n':
+	    editor.pos = editor.len;
+	    refreshline();
+	    ttywrite("\n", 1);
+	    editor.buf[editor.len++] = '\n';
+	    editor.buf[editor.len] = '\0';
+	    cookedmode();
+	    return editor.buf;
+	case CTRLKEY('C'):
+	    ttywrite("^C\n", 3);
+	    editor.len = editor.pos = 0;
+	    editor.histpos = hist.n;
+	    break;
+	case CTRLKEY('D'):
+	    if (editor.len == 0) {
+		ttywrite("\n", 1);
+		cookedmode();
+		return NULL;
+	    }
+	    /* fall through */
+	case KEY_DELETE:
+	    if (editor.pos < editor.len)
+		editdelete(editor.pos, 1);
+	    break;
+	case 127:
+	case CTRLKEY('H'):
+	    if (editor.pos > 0)
+		editdelete(editor.pos - 1, 1);
+	    break;
+	case CTRLKEY('A'):
+	    editor.pos = 0;
+	    break;
+	case CTRLKEY('E'):
+	    editor.pos = editor.len;
+	    break;
+	case CTRLKEY('B'):
+	    if (editor.pos > 0)
+		editor.pos--;
+	    break;
+	case CTRLKEY('F'):
+	    if (editor.pos < editor.len)
+		editor.pos++;
+	    break;
+	case CTRLKEY('K'):
+	    editor.len = editor.pos;
+	    break;
+	case CTRLKEY('U'):
+	    editdelete(0, editor.pos);
+	    break;
+	case CTRLKEY('W'):
+	    for (i = editor.pos; i > 0 && editor.buf[i - 1] == ' '; i--)
+		;
+	    while (i > 0 && editor.buf[i - 1] != ' ')
+		i--;
+	    editdelete(i, editor.pos - i);
+	    break;
+	case CTRLKEY('P'):
+	    if (hist.on && editor.histpos > 0)
+		edithistory(editor.histpos - 1);
+	    break;
+	case CTRLKEY('N'):
+	    if (hist.on && editor.histpos < hist.n)
+		edithistory(editor.histpos + 1);
+	    break;
+	case CTRLKEY('L'):
+	    ttywrite("\x1b[H\x1b[2J", 7);
+	    break;
+	case '\t':
+	    complete(tabs > 1);
+	    break;
+	default:
+	    if (c >= ' ' && c != 127 && c < KEY_DELETE) {
+		ch = c;
+		editinsert(&ch, 1);
+	    }
+	}
+	refreshline();
+    }
+    ttywrite("\n", 1);
+    cookedmode();
+    return NULL;
+}
+
+/****************************
+ * Command completion routines
+ ****************************/
+
+/*
+ * Command names are completed from a trie of the executables in PATH.
+ * A thread builds it in the background, first when the editor starts
+ * and again whenever inotify reports a change to a PATH directory (or
+ * PATH itself changes), so completing never reads a directory. Each
+ * trie node counts the names below it, so a completion costs the length
+ * of the word, however many names match. Arguments are completed from
+ * the directory they name.
+ */
+
+/* trienode - Append a node for byte c to trie, return its index */
+static int trienode(struct trie_t *trie, int c)
+{
+    struct trienode_t *node;
+
+    if (trie->nnodes == trie->cap) {
+	trie->cap = trie->cap ? 2 * trie->cap : 1024;
+	trie->nodes = Realloc(trie->nodes, trie->cap * sizeof(*node));
     }
+    node = &trie->nodes[trie->nnodes];
+    memset(node, 0, sizeof(*node));
+    node->c = c;
+    return trie->nnodes++;
+}
 
-    // change the state according to arg1
-    if (strcmp(arg1, "bg") == 0)
-    {
-        (*do_job).state = BG; // change the job into BG
-        printf("[%d] (%d) %s", (*do_job).jid, (*do_job).pid, (*do_job).cmdline); // print BG
-	/*
-	 * int kill (pid_t pid, int sig);
-	 * sends signal 'sig' to the process (pid)
-	 * send SIGCONT so that the process can continue after its state has been changed. 
-	*/
-        kill(-(*do_job).pid, SIGCONT); // sends SIGCONT to continue as BG process.
+/* triefind - The node reached by the len bytes of s, or -1 */
+static int triefind(struct trie_t *trie, const char *s, size_t len)
+{
+    int n = 0, k;
+
+    for (; len > 0; s++, len--) {
+	for (k = trie->nodes[n].child; k && trie->nodes[k].c < (unsigned char)*s; k = trie->nodes[k].next)
+	    ;
+	if (!k || trie->nodes[k].c != (unsigned char)*s)
+	    return -1;
+	n = k;
     }
-    else if (strcmp(arg1, "fg") == 0)
-    {
-        (*do_job).state = FG; // change the job into FG
-        kill(-(*do_job).pid, SIGCONT); // sends SIGCONT to continue as FG process.
-        waitfg((*do_job).pid); // wait until pid (now FG) is finished. 
+    return n;
+}
+
+/* trieinsert - Add name to trie, unless it is there already */
+static void trieinsert(struct trie_t *trie, const char *name)
+{
+    int n = 0, k, prev, m;
+
+    if ((k = triefind(trie, name, strlen(name))) >= 0 && trie->nodes[k].end)
+	return;
+    trie->nodes[0].count++;
+    for (; *name; name++) {
+	/* children are kept in byte order */
+	for (prev = 0, k = trie->nodes[n].child; k && trie->nodes[k].c < (unsigned char)*name;
+	     prev = k, k = trie->nodes[k].next)
+	    ;
+	if (!k || trie->nodes[k].c != (unsigned char)*name) {
+	    m = trienode(trie, (unsigned char)*name);
+	    trie->nodes[m].next = k;
+	    if (prev)
+		trie->nodes[prev].next = m;
+	    else
+		trie->nodes[n].child = m;
+	    k = m;
+	}
+	trie->nodes[k].count++;
+	n = k;
     }
-    return;
+    trie->nodes[n].end = 1;
 }
 
-/* 
- * waitfg - Block until process pid is no longer the foreground process
- */
-void waitfg(pid_t pid)
+/* freetrie - Free a trie made by buildtrie */
+static void freetrie(struct trie_t *trie)
 {
-    // in waitfg, wait only with sleep(), and let sigchld_handler do the reaping. 
-    if (!pid) return; // is pid valid?
-    struct job_t *job = getjobpid(jobs, pid); // fetch the job of pid
-    while ((*job).state == FG) {sleep(1);} // LOOOOOOOOOOOP when pid is FG
-    return;
+    if (trie != NULL) {
+	free(trie->nodes);
+	free(trie);
+    }
 }
 
-/*****************
- * Signal handlers
- *****************/
+/* buildtrie - A trie of the executables in the directories of pathvar */
+static struct trie_t *buildtrie(const char *pathvar)
+{
+    struct trie_t *trie = Realloc(NULL, sizeof(*trie));
+    const char *p, *end;
+    char dir[PATH_MAX];
+    struct dirent *de;
+    struct stat sb;
+    DIR *dp;
 
-/* 
- * sigchld_handler - The kernel sends a SIGCHLD to the shell whenever
- *     a child job terminates (becomes a zombie), or stops because it
- *     received a SIGSTOP or SIGTSTP signal. The handler reaps all
- *     available zombie children, but doesn't wait for any other
- *     currently running children to terminate.  
- */
-void sigchld_handler(int sig)
+    memset(trie, 0, sizeof(*trie));
+    trienode(trie, 0);          /* the root */
+    for (p = pathvar; ; p = end + 1) {
+	end = p + strcspn(p, ":");
+	snprintf(dir, sizeof(dir), "%.*s", (int)(end - p), (end > p) ? p : ".");
+	if ((dp = opendir(dir)) != NULL) {
+	    while ((de = readdir(dp)) != NULL) {
+		if (de->d_name[0] == '.' && (de->d_name[1] == '\0' ||
+					     (de->d_name[1] == '.' && de->d_name[2] == '\0')))
+		    continue;
+		if (de->d_type != DT_REG && de->d_type != DT_LNK && de->d_type != DT_UNKNOWN)
+		    continue;
+		if (de->d_type != DT_REG &&
+		    (fstatat(dirfd(dp), de->d_name, &sb, 0) < 0 || !S_ISREG(sb.st_mode)))
+		    continue;
+		if (faccessat(dirfd(dp), de->d_name, X_OK, 0) == 0)
+		    trieinsert(trie, de->d_name);
+	    }
+	    closedir(dp);
+	}
+	if (*end == '\0')
+	    break;
+    }
+    return trie;
+}
+
+/* completer - The thread that builds the tries requested */
+static void *completer(void *arg)
 {
-    pid_t pid_chld;
-    int jid_chld;
-    int status;
-    sigset_t mask_all; // Mask with all signals
-    sigset_t prev_all; // Mask with previous blocked[]
+    struct trie_t *trie, *old;
+    char *pathvar;
+    int want;
 
-    sigfillset(&mask_all); // Add every signal number so we can block all signals
+    pthread_mutex_lock(&comp.lock);
+    while (1) {
+	while (comp.built == comp.requested)
+	    pthread_cond_wait(&comp.cond, &comp.lock);
+	want = comp.requested;
+	pathvar = strdup(comp.pathvar);
+	pthread_mutex_unlock(&comp.lock);
 
-    // WNOHANG: return 0 if no child in the wait set is terminated or stopped
-    // WUNTRACED: return pid if any child in wait set is signaled or stopped
-    while((pid_chld = waitpid(-1, &status, WUNTRACED | WNOHANG)) > 0)
-    {
-        // child terminated normally, WIFEXITED = 1
-        if (WIFEXITED(status))
-        {
-	    sigprocmask(SIG_BLOCK, &mask_all, &prev_all); // Synchronize by blocking all signals to avoid races
-            deletejob(jobs, pid_chld); // delete the child process
-	    sigprocmask(SIG_SETMASK, &prev_all, NULL); // restore previous blocked[]
-        }
-        // child terminated by signal. WIFSIGNALED = 1
-        else if (WIFSIGNALED(status))
-        {
-	    sigprocmask(SIG_BLOCK, &mask_all, &prev_all);
-            jid_chld = pid2jid(pid_chld);
-   	    deletejob(jobs, pid_chld); // delete the child process
-	    printf("Job [%d] (%d) terminated by signal %d\n", jid_chld, (int)pid_chld, WTERMSIG(status));
-	    sigprocmask(SIG_SETMASK, &prev_all, NULL);
-        }
-        // if stop signal arrived to child, WIFSTOPPED = 1 (distinguish stopped and terminated childs)
-        else if (WIFSTOPPED(status))
-        {
-	    sigprocmask(SIG_BLOCK, &mask_all, &prev_all);
-            jid_chld = pid2jid(pid_chld); // get jid
-            (*getjobpid(jobs, pid_chld)).state = ST; // set the state as STOPPED
-            printf("Job [%d] (%d) stopped by signal %d\n", jid_chld, (int)pid_chld, WSTOPSIG(status));
-	    sigprocmask(SIG_SETMASK, &prev_all, NULL);
-        }
+	trie = buildtrie(pathvar);
+	free(pathvar);
+
+	/* the main thread only looks at comp.trie with the lock held */
+	pthread_mutex_lock(&comp.lock);
+	old = comp.trie;
+	comp.trie = trie;
+	comp.built = want;
+	pthread_cond_broadcast(&comp.cond);
+	pthread_mutex_unlock(&comp.lock);
+	freetrie(old);
+	pthread_mutex_lock(&comp.lock);
     }
-    return;
+    return NULL;
 }
 
-/* 
- * sigint_handler - The kernel sends a SIGINT to the shell whenver the
- *    user types ctrl-c at the keyboard.  Catch it and send it along
- *    to the foreground job.  
+/*
+ * requesttrie - Have the completer build a new trie from the current
+ *    PATH, and watch its directories for changes
  */
-void sigint_handler(int sig)
+static void requesttrie(void)
 {
-    pid_t pid_fg = fgpid(jobs); // current FG process in the jobs list
-    if (pid_fg != 0) kill(-pid_fg, sig); // SIGINT sent to FG process group
-    return;
+    struct epoll_event ev;
+    const char *pathvar = getenv("PATH");
+    const char *p, *end;
+    char dir[PATH_MAX];
+
+    if (pathvar == NULL)
+	pathvar = "";
+    if (comp.watched == NULL || strcmp(comp.watched, pathvar) != 0) {
+	if (comp.inotifyfd >= 0)
+	    close(comp.inotifyfd);  /* also leaves epfd */
+	if ((comp.inotifyfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) >= 0) {
+	    for (p = pathvar; ; p = end + 1) {
+		end = p + strcspn(p, ":");
+		snprintf(dir, sizeof(dir), "%.*s", (int)(end - p), (end > p) ? p : ".");
+		inotify_add_watch(comp.inotifyfd, dir, IN_CREATE | IN_DELETE | IN_ATTRIB |
+				  IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+		if (*end == '\0')
+		    break;
+	    }
+	    ev.events = EPOLLIN;
+	    ev.data.fd = comp.inotifyfd;
+	    epoll_ctl(epfd, EPOLL_CTL_ADD, comp.inotifyfd, &ev);
+	}
+	free(comp.watched);
+	comp.watched = strdup(pathvar);
+    }
+
+    pthread_mutex_lock(&comp.lock);
+    free(comp.pathvar);
+    comp.pathvar = strdup(pathvar);
+    comp.requested++;
+    pthread_cond_signal(&comp.cond);
+    pthread_mutex_unlock(&comp.lock);
 }
 
 /*
- * sigtstp_handler - The kernel sends a SIGTSTP to the shell whenever
- *     the user types ctrl-z at the keyboard. Catch it and suspend the
- *     foreground job by sending it a SIGTSTP.  
+ * startcompleter - Start the completer thread and its first trie, once.
+ *    The job-control signals are blocked, and stay so in the thread.
  */
-void sigtstp_handler(int sig)
+void startcompleter(void)
 {
-    pid_t pid_fg = fgpid(jobs); // current FG process in the jobs list
-    if (pid_fg != 0) kill(-pid_fg, sig); // SIGTSTP sent to FG process group
-    return;
+    pthread_t tid;
+
+    if (comp.started)
+	return;
+    comp.started = 1;
+    comp.inotifyfd = -1;
+    pthread_mutex_init(&comp.lock, NULL);
+    pthread_cond_init(&comp.cond, NULL);
+    if ((errno = pthread_create(&tid, NULL, completer, NULL)) != 0)
+	unix_error("pthread_create error");
+    pthread_detach(tid);
+    requesttrie();
 }
-/*********************
- * End signal handlers
- *********************/
 
-/***********************************************
- * Helper routines that manipulate the job list
- **********************************************/
+/* pathchanged - A PATH directory changed (inotifyfd is readable): rebuild */
+void pathchanged(void)
+{
+    char buf[4096];
 
-/* clearjob - Clear the entries in a job struct */
-void clearjob(struct job_t *job) {
-    job->pid = 0;
-    job->jid = 0;
-    job->state = UNDEF;
-    job->cmdline[0] = '\0';
+    while (read(comp.inotifyfd, buf, sizeof(buf)) > 0)
+	;
+    requesttrie();
 }
 
-/* initjobs - Initialize the job list */
-void initjobs(struct job_t *jobs) {
-    int i;
+/* addmatch - Append name (len bytes, plus suffix if not 0) to the matches */
+static void addmatch(struct matches_t *m, const char *name, size_t len, int suffix)
+{
+    if (m->n == m->cap) {
+	m->cap = m->cap ? 2 * m->cap : 64;
+	m->v = Realloc(m->v, m->cap * sizeof(char *));
+    }
+    m->v[m->n] = Realloc(NULL, len + 2);
+    memcpy(m->v[m->n], name, len);
+    m->v[m->n][len] = suffix;
+    m->v[m->n][len + 1] = '\0';
+    m->n++;
+}
 
-    for (i = 0; i < MAXJOBS; i++)
-	clearjob(&jobs[i]);
+/* triematches - Add up to max names below node n (with prefix word) to m */
+static void triematches(struct trie_t *trie, int n, char *word, size_t len,
+			struct matches_t *m, int max)
+{
+    int k;
+
+    if (trie->nodes[n].end)
+	addmatch(m, word, len, 0);
+    for (k = trie->nodes[n].child; k && m->n < max && len < PATH_MAX - 1; k = trie->nodes[k].next) {
+	word[len] = trie->nodes[k].c;
+	triematches(trie, k, word, len + 1, m, max);
+    }
 }
 
-/* maxjid - Returns largest allocated job ID */
-int maxjid(struct job_t *jobs) 
+/* commonlen - Length of the common prefix of a (alen bytes) and b */
+static size_t commonlen(const char *a, size_t alen, const char *b)
 {
-    int i, max=0;
+    size_t i;
 
-    for (i = 0; i < MAXJOBS; i++)
-	if (jobs[i].jid > max)
-	    max = jobs[i].jid;
-    return max;
+    for (i = 0; i < alen && a[i] == b[i]; i++)
+	;
+    return i;
 }
 
-/* addjob - Add a job to the job list */
-int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline) 
+/* matchcmp - Order matches by name, for qsort */
+static int matchcmp(const void *a, const void *b)
 {
-    int i;
-    
-    if (pid < 1)
-	return 0;
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
 
-    for (i = 0; i < MAXJOBS; i++) {
-	if (jobs[i].pid == 0) {
-	    jobs[i].pid = pid;
-	    jobs[i].state = state;
-	    jobs[i].jid = nextjid++;
-	    if (nextjid > MAXJOBS)
-		nextjid = 1;
-	    strcpy(jobs[i].cmdline, cmdline);
-  	    if(verbose){
-	        printf("Added job [%d] %d %s\n", jobs[i].jid, jobs[i].pid, jobs[i].cmdline);
-            }
-            return 1;
+/*
+ * completecommand - Find the commands starting with word. Put their
+ *    longest common prefix in word (PATH_MAX bytes), and, if list, up
+ *    to LISTMAX of them in m. Returns how many there are.
+ */
+static int completecommand(char *word, struct matches_t *m, int list)
+{
+    struct builtin_t *b;
+    size_t len = strlen(word), lcp = 0;
+    char name[PATH_MAX];        /* names built by triematches */
+    int n, k, count = 0;
+    int first = 1;              /* no match seen yet */
+
+    /* a build in progress, e.g. after a PATH change, is waited for */
+    if ((comp.watched == NULL) || (strcmp(comp.watched, getenv("PATH") ? getenv("PATH") : "") != 0))
+	requesttrie();
+    pthread_mutex_lock(&comp.lock);
+    while (comp.built < comp.requested)
+	pthread_cond_wait(&comp.cond, &comp.lock);
+    if ((n = triefind(comp.trie, word, len)) >= 0 && (count = comp.trie->nodes[n].count) > 0) {
+	/* the common prefix: follow single children down to a name */
+	for (lcp = len, k = n; !comp.trie->nodes[k].end && lcp < PATH_MAX - 1 &&
+		 (k = comp.trie->nodes[k].child) && !comp.trie->nodes[k].next; )
+	    word[lcp++] = comp.trie->nodes[k].c;
+	first = 0;
+	if (list) {
+	    memcpy(name, word, len);
+	    triematches(comp.trie, n, name, len, m, LISTMAX);
 	}
     }
-    printf("Tried to create too many jobs\n");
-    return 0;
+
+    /* builtins that aren't also programs */
+    for (b = builtins; b->name != NULL; b++) {
+	if (b->fn == NULL || strncmp(b->name, word, len) != 0 ||
+	    ((k = triefind(comp.trie, b->name, strlen(b->name))) >= 0 && comp.trie->nodes[k].end))
+	    continue;
+	if (first)
+	    lcp = strlen(strcpy(word, b->name));
+	else
+	    lcp = len + commonlen(word + len, lcp - len, b->name + len);
+	first = 0;
+	count++;
+	if (list && m->n < LISTMAX)
+	    addmatch(m, b->name, strlen(b->name), 0);
+    }
+    pthread_mutex_unlock(&comp.lock);
+    word[(count > 0) ? lcp : len] = '\0';
+    return count;
 }
 
-/* deletejob - Delete a job whose PID=pid from the job list */
-int deletejob(struct job_t *jobs, pid_t pid) 
+/*
+ * completefile - Like completecommand, for the files starting with word
+ *    (a path); directories get a / appended
+ */
+static int completefile(char *word, struct matches_t *m, int list)
 {
-    int i;
+    char dir[PATH_MAX], lcpbuf[PATH_MAX];
+    char *slash = strrchr(word, '/'), *base = slash ? slash + 1 : word;
+    size_t blen = strlen(base), lcp = 0;
+    struct dirent *de;
+    struct stat sb;
+    int count = 0, isdir = 0;
+    DIR *dp;
 
-    if (pid < 1)
+    if (slash == NULL)
+	strcpy(dir, ".");
+    else
+	snprintf(dir, sizeof(dir), "%.*s", (slash == word) ? 1 : (int)(slash - word), word);
+    if ((dp = opendir(dir)) == NULL)
 	return 0;
+    while ((de = readdir(dp)) != NULL) {
+	if (strncmp(de->d_name, base, blen) != 0 || (de->d_name[0] == '.' && base[0] != '.') ||
+	    strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+	    continue;
+	isdir = (de->d_type == DT_DIR) || ((de->d_type == DT_LNK || de->d_type == DT_UNKNOWN) &&
+		 fstatat(dirfd(dp), de->d_name, &sb, 0) == 0 && S_ISDIR(sb.st_mode));
+	if (count++ == 0)
+	    lcp = strlen(strcpy(lcpbuf, de->d_name));
+	else
+	    lcp = commonlen(lcpbuf, lcp, de->d_name);
+	if (list && m->n < LISTMAX)
+	    addmatch(m, de->d_name, strlen(de->d_name), isdir ? '/' : 0);
+    }
+    closedir(dp);
+    if (count > 0 && (size_t)(base - word) + lcp + 2 < PATH_MAX) {
+	memcpy(base, lcpbuf, lcp);
+	base[lcp] = (count == 1 && isdir) ? '/' : '\0';
+	base[lcp + 1] = '\0';
+    }
+    return count;
+}
+
+/*
+ * complete - Tab: complete the word before the cursor, as a command if
+ *    it is the first of a pipeline stage, else as a file. A unique match
+ *    is finished with a blank (or / for a directory); if list (a second
+ *    tab) and there are several, they are listed below the line.
+ */
+void complete(int list)
+{
+    char word[PATH_MAX], out[2 * PATH_MAX], col[PATH_MAX + 2];
+    struct matches_t m = {NULL, 0, 0};
+    size_t start, i, len, maxlen = 0, cmd;
+    int count, j, n, percol;
+
+    /* the word: back to an unescaped blank; drop its backslashes */
+    for (start = editor.pos; start > 0 &&
+	     !(strchr(" \t|&<>;", editor.buf[start - 1]) && (start < 2 || editor.buf[start - 2] != '\\'));
+	 start--)
+	;
+    for (i = start, len = 0; i < editor.pos && len < PATH_MAX - 2; i++) {
+	if (editor.buf[i] == '\\' && i + 1 < editor.pos)
+	    i++;
+	word[len++] = editor.buf[i];
+    }
+    word[len] = '\0';
+    for (cmd = start; cmd > 0 && editor.buf[cmd - 1] == ' '; cmd--)
+	;
+    cmd = (cmd == 0 || editor.buf[cmd - 1] == '|') && strchr(word, '/') == NULL;
+
+    count = cmd ? completecommand(word, &m, list) : completefile(word, &m, list);
+    if (count == 0) {
+	ttywrite("\a", 1);
+	return;
+    }
+
+    /* insert what the matches have in common, escaped like the tokenizer wants */
+    for (i = len, j = 0; word[i] != '\0'; i++) {
+	if (strchr(" \t'\"\\|&<>", word[i]))
+	    out[j++] = '\\';
+	out[j++] = word[i];
+    }
+    if (count == 1 && (j == 0 || out[j - 1] != '/'))
+	out[j++] = ' ';
+    editinsert(out, j);
 
-    for (i = 0; i < MAXJOBS; i++) {
-	if (jobs[i].pid == pid) {
-	    clearjob(&jobs[i]);
-	    nextjid = maxjid(jobs)+1;
-	    return 1;
+    if (list && count > 1) {
+	qsort(m.v, m.n, sizeof(char *), matchcmp);
+	for (j = 0; j < m.n; j++)
+	    if (strlen(m.v[j]) > maxlen)
+		maxlen = strlen(m.v[j]);
+	percol = editor.cols / (int)(maxlen + 2);
+	ttywrite("\n", 1);
+	for (j = 0; j < m.n; j++) {
+	    n = snprintf(col, sizeof(col), "%-*s", (int)maxlen + 2, m.v[j]);
+	    ttywrite(col, n);
+	    if (percol <= 1 || j % percol == percol - 1 || j == m.n - 1)
+		ttywrite("\n", 1);
+	}
+	if (count > m.n) {
+	    n = snprintf(col, sizeof(col), "... and %d more\n", count - m.n);
+	    ttywrite(col, n);
 	}
     }
-    return 0;
+    for (j = 0; j < m.n; j++)
+	free(m.v[j]);
+    free(m.v);
 }
 
-/* fgpid - Return PID of current foreground job, 0 if no such job */
-pid_t fgpid(struct job_t *jobs) {
-    int i;
+/***********************
+ * Event loop routines
+ ***********************/
 
-    for (i = 0; i < MAXJOBS; i++)
-	if (jobs[i].state == FG)
-	    return jobs[i].pid;
-    return 0;
+/*
+ * initevents - Block the job-control signals and set up sigfd and epfd
+ */
+void initevents(void)
+{
+    struct epoll_event ev;
+    int sig;
+
+    sigemptyset(&shell_mask);
+    sigaddset(&shell_mask, SIGINT);   /* ctrl-c */
+    sigaddset(&shell_mask, SIGTSTP);  /* ctrl-z */
+    sigaddset(&shell_mask, SIGCHLD);  /* Terminated or stopped child */
+    sigaddset(&shell_mask, SIGQUIT);  /* clean way to kill the shell */
+
+    /* An ignored signal is discarded instead of queued on sigfd (and the
+     * SIG_IGN would leak into our children), so reset the dispositions we
+     * may have inherited, e.g. SIGINT when started in the background */
+    for (sig = 1; sig < NSIG; sig++)
+	if (sigismember(&shell_mask, sig))
+	    signal(sig, SIG_DFL);
+
+    if (sigprocmask(SIG_BLOCK, &shell_mask, &prev_mask) < 0)
+	unix_error("sigprocmask error");
+
+    if ((sigfd = signalfd(-1, &shell_mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+	unix_error("signalfd error");
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+	unix_error("epoll_create1 error");
+
+    ev.events = EPOLLIN;
+    ev.data.fd = sigfd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sigfd, &ev) < 0)
+	unix_error("epoll_ctl error");
 }
 
-/* getjobpid  - Find a job (by PID) on the job list */
-struct job_t *getjobpid(struct job_t *jobs, pid_t pid) {
-    int i;
+/*
+ * initinput - Read command lines from fd. The rest of a regular file is
+ *    mapped into memory in one go. Anything else (pipe, terminal) is
+ *    registered with epfd and read INBUFSIZE bytes at a time.
+ */
+void initinput(int fd)
+{
+    struct epoll_event ev;
+    struct stat sb;
+    off_t off;
 
-    if (pid < 1)
-	return NULL;
-    for (i = 0; i < MAXJOBS; i++)
-	if (jobs[i].pid == pid)
-	    return &jobs[i];
-    return NULL;
+    memset(&input, 0, sizeof(input));
+    input.fd = fd;
+    if (fstat(fd, &sb) == 0) {
+	input.dev = sb.st_dev;
+	input.ino = sb.st_ino;
+    }
+    if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode)) {
+	/* mmap offsets must be page aligned; skip to where fd is at */
+	off = lseek(fd, 0, SEEK_CUR);
+	if (off >= 0 && sb.st_size > off) {
+	    input.buf = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	    if (input.buf != MAP_FAILED) {
+		madvise(input.buf, sb.st_size, MADV_SEQUENTIAL);
+		input.mapped = 1;
+		input.len = sb.st_size;
+		input.pos = off;
+		input.eof = 1;
+		return;
+	    }
+	}
+	else if (off >= 0) {
+	    input.eof = 1;  /* nothing left to read */
+	    return;
+	}
+    }
+
+    input.cap = INBUFSIZE;
+    input.buf = Realloc(NULL, input.cap);
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0)
+	input.pollable = 1;
+    else if (errno != EPERM) /* regular files can't be polled, and never block */
+	unix_error("epoll_ctl error");
 }
 
-/* getjobjid  - Find a job (by JID) on the job list */
-struct job_t *getjobjid(struct job_t *jobs, int jid) 
+/*
+ * dispatch_signals - Drain sigfd and run the handler for each signal.
+ *    Several SIGCHLDs may be coalesced into one; sigchld_handler reaps
+ *    every available child, so none is lost. Then start any queued jobs
+ *    that now fit.
+ */
+void dispatch_signals(void)
 {
+    struct signalfd_siginfo si[16];
+    ssize_t n;
     int i;
 
-    if (jid < 1)
-	return NULL;
-    for (i = 0; i < MAXJOBS; i++)
-	if (jobs[i].jid == jid)
-	    return &jobs[i];
-    return NULL;
+    while ((n = read(sigfd, si, sizeof(si))) > 0) {
+	for (i = 0; i < n / (ssize_t)sizeof(si[0]); i++) {
+	    switch (si[i].ssi_signo) {
+	    case SIGCHLD:
+		sigchld_handler(SIGCHLD);
+		break;
+	    case SIGINT:
+		sigint_handler(SIGINT);
+		break;
+	    case SIGTSTP:
+		sigtstp_handler(SIGTSTP);
+		break;
+	    case SIGQUIT:
+		sigquit_handler(SIGQUIT);
+		break;
+	    }
+	}
+    }
+    if (n < 0 && errno != EAGAIN && errno != EINTR)
+	unix_error("signalfd read error");
+
+    /* Jobs that just ended may have made room for queued ones */
+    admitjobs();
 }
 
-/* pid2jid - Map process ID to job ID */
-int pid2jid(pid_t pid) 
+/*
+ * wait_signals - Block until sigfd is readable, then dispatch
+ */
+void wait_signals(void)
 {
-    int i;
+    struct pollfd pfd;
 
-    if (pid < 1)
-	return 0;
-    for (i = 0; i < MAXJOBS; i++)
-	if (jobs[i].pid == pid) {
-            return jobs[i].jid;
-        }
-    return 0;
+    fflush(stdout);
+    pfd.fd = sigfd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+	unix_error("poll error");
+    dispatch_signals();
 }
 
-/* listjobs - Print the job list */
-void listjobs(struct job_t *jobs) 
+/*
+ * readcmdline - Read the next command line, ending in a newline, and
+ *    return it (valid until the next call), or NULL on end of file.
+ *    Lines are cut out of a large block of input, so reading a line
+ *    costs no system call unless the block is used up; the block grows
+ *    to hold lines of any length. Signals are dispatched before every
+ *    line and while waiting for input, and output is only flushed when
+ *    we are about to wait. A last line without a newline gets one.
+ *    Lines typed at a terminal come from the line editor instead.
+ */
+char *readcmdline(void)
 {
-    int i;
-    
-    for (i = 0; i < MAXJOBS; i++) {
-	if (jobs[i].pid != 0) {
-	    printf("[%d] (%d) ", jobs[i].jid, jobs[i].pid);
-	    switch (jobs[i].state) {
-		case BG: 
-		    printf("Running ");
-		    break;
-		case FG: 
-		    printf("Foreground ");
-		    break;
-		case ST: 
-		    printf("Stopped ");
-		    break;
-	    default:
-		    printf("listjobs: Internal error: job[%d].state=%d ", 
-			   i, jobs[i].state);
+    char *line, *nl;
+    size_t len;
+
+    if (editor.on)
+	return editline();
+    dispatch_signals();
+    while (1) {
+	/* Return a complete line */
+	line = input.buf + input.pos;
+	len = input.len - input.pos;
+	nl = memchr(line, '\n', len);
+	if (nl != NULL || (input.eof && len > 0)) {
+	    if (nl != NULL)
+		len = nl - line + 1;
+	    if (len + 2 > input.linecap) {
+		input.linecap = (len + 2 > MAXLINE) ? len + 2 : MAXLINE;
+		input.line = Realloc(input.line, input.linecap);
 	    }
-	    printf("%s", jobs[i].cmdline);
+	    memcpy(input.line, line, len);
+	    input.pos += len;
+	    if (input.line[len - 1] != '\n')
+		input.line[len++] = '\n';
+	    input.line[len] = '\0';
+	    return input.line;
 	}
+	if (input.eof)
+	    return NULL;
+	fillinput();
     }
 }
-/******************************
- * end job list helper routines
- ******************************/
 
+/*
+ * fillinput - Read more input into input.buf, growing it if it is full.
+ *    Signals (and PATH changes, for the completer) are handled while
+ *    we wait. Sets input.eof at end of file.
+ */
+void fillinput(void)
+{
+    struct epoll_event ev;
+    ssize_t n;
+
+    /* Make room at the end of the buffer for more input */
+    if (input.pos > 0) {
+	memmove(input.buf, input.buf + input.pos, input.len - input.pos);
+	input.len -= input.pos;
+	input.pos = 0;
+    }
+    if (input.len == input.cap) {
+	input.cap *= 2;
+	input.buf = Realloc(input.buf, input.cap);
+    }
+
+    while (1) {
+	/* Wait for input, handling any signals that arrive meanwhile */
+	if (input.pollable) {
+	    fflush(stdout);
+	    if (epoll_wait(epfd, &ev, 1, -1) < 0) {
+		if (errno == EINTR)
+		    continue;
+		unix_error("epoll_wait error");
+	    }
+	    if (ev.data.fd == sigfd) {
+		dispatch_signals();
+		continue;
+	    }
+	    if (comp.started && ev.data.fd == comp.inotifyfd) {
+		pathchanged();
+		continue;
+	    }
+	}
+
+	n = read(input.fd, input.buf + input.len, input.cap - input.len);
+	if (n < 0) {
+	    if (errno == EINTR || errno == EAGAIN)
+		continue;
+	    app_error("read error");
+	}
+	if (n == 0)
+	    input.eof = 1;
+	input.len += n;
+	return;
+    }
+}
 
 /***********************
  * Other helper routines
@@ -664,10 +5267,16 @@ void listjobs(struct job_t *jobs)
  */
 void usage(void) 
 {
-    printf("Usage: shell [-hvp]\n");
+    printf("Usage: shell [-hvpFBs] [-f <script>] [-j <n>] [-t <tracefile>]\n");
     printf("   -h   print this message\n");
     printf("   -v   print additional diagnostic information\n");
     printf("   -p   do not emit a command prompt\n");
+    printf("   -F   launch commands with fork/exec instead of posix_spawn\n");
+    printf("   -B   run echo, printf, test, sleep, ... as programs, not in the shell\n");
+    printf("   -f   read commands from the file <script> (no prompt)\n");
+    printf("   -j   run at most <n> background jobs at once, queue the rest\n");
+    printf("   -s   spread background jobs over the CPUs, round-robin\n");
+    printf("   -t   trace jobs, write a Chrome trace to <tracefile> at exit\n");
     exit(1);
 }
 
@@ -690,19 +5299,13 @@ void app_error(char *msg)
 }
 
 /*
- * Signal - wrapper for the sigaction function
+ * Realloc - realloc wrapper; realloc(NULL, size) is used for malloc
  */
-handler_t *Signal(int signum, handler_t *handler) 
+void *Realloc(void *ptr, size_t size)
 {
-    struct sigaction action, old_action;
-
-    action.sa_handler = handler;  
-    sigemptyset(&action.sa_mask); /* block sigs of type being handled */
-    action.sa_flags = SA_RESTART; /* restart syscalls if possible */
-
-    if (sigaction(signum, &action, &old_action) < 0)
-	unix_error("Signal error");
-    return (old_action.sa_handler);
+    if ((ptr = realloc(ptr, size)) == NULL)
+	unix_error("Realloc error");
+    return ptr;
 }
 
 /*
@@ -711,6 +5314,7 @@ handler_t *Signal(int signum, handler_t *handler)
  */
 void sigquit_handler(int sig) 
 {
+    drainevents();
     printf("Terminating after receipt of SIGQUIT signal\n");
     exit(1);
 }
@@ -0,0 +1,241 @@
+/*
+ * workload.c - A configurable job for testing and loading your shell
+ *
+ * usage: workload [-t <ms>] [-c <threads>] [-m <mb>] [-o <rate>]
+ *                 [-f <width>x<depth>] [-k <sig>@<ms>]...
+ *
+ * Runs for <ms> milliseconds (default 1000), timed on the monotonic
+ * clock from the start, and meanwhile
+ *     -c <threads>      burns CPU on <threads> threads (else it sleeps)
+ *     -m <mb>           holds <mb> MB of memory, all of it touched
+ *     -o <rate>         writes 64-byte lines to stdout at <rate> bytes
+ *                       per second, or as fast as it can if <rate> is 0
+ *     -f <w>x<d>        first forks a tree of processes <w> wide and <d>
+ *                       deep, each of which does all of the above; a
+ *                       process exits once its children have
+ *     -k <sig>@<ms>     sends <sig> (a name like TSTP, or a number) to
+ *                       its process group <ms> milliseconds after the
+ *                       start; -k may be given several times
+ * Time spent stopped counts towards <ms>, as it does for myspin. The
+ * little programs the traces use are special cases:
+ *     myspin n    workload -t n000
+ *     mysplit n   workload -t n000 -f 1x1
+ *     mystop n    workload -t n000 -k TSTP@n000
+ *     myint n     workload -t n000 -k INT@n000
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define MAXKILLS  16        /* -k options */
+#define MAXTHREADS 256      /* -c threads */
+#define LINELEN   64        /* bytes per -o line */
+
+struct killat {             /* A -k signal to send */
+    int sig;
+    long long at;           /* when, ns after the start */
+};
+
+struct signame {
+    char *name;
+    int sig;
+} signames[] = {
+    {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL},
+    {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"PIPE", SIGPIPE}, {"ALRM", SIGALRM},
+    {"TERM", SIGTERM}, {"CHLD", SIGCHLD}, {"CONT", SIGCONT}, {"STOP", SIGSTOP},
+    {"TSTP", SIGTSTP}, {"TTIN", SIGTTIN}, {"TTOU", SIGTTOU}, {NULL, 0}
+};
+
+long long deadline;         /* when to stop, on the monotonic clock */
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: workload [-t <ms>] [-c <threads>] [-m <mb>] [-o <rate>]\n"
+	    "                [-f <width>x<depth>] [-k <sig>@<ms>]...\n");
+    exit(1);
+}
+
+void unix_error(char *msg)
+{
+    fprintf(stderr, "workload: %s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+/* now - Nanoseconds on the monotonic clock */
+long long now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* sleepuntil - Sleep until ns on the monotonic clock (or a signal) */
+void sleepuntil(long long ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ns / 1000000000LL;
+    ts.tv_nsec = ns % 1000000000LL;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+/* parsesig - Return the signal called str (with or without SIG), -1 if none */
+int parsesig(const char *str)
+{
+    int i;
+
+    if (isdigit((unsigned char)str[0]))
+	return atoi(str);
+    if (strncmp(str, "SIG", 3) == 0)
+	str += 3;
+    for (i = 0; signames[i].name != NULL; i++)
+	if (strcmp(signames[i].name, str) == 0)
+	    return signames[i].sig;
+    return -1;
+}
+
+int cmpkill(const void *a, const void *b)
+{
+    const struct killat *x = a, *y = b;
+
+    return (x->at > y->at) - (x->at < y->at);
+}
+
+/* burn - A -c thread: spin until the deadline */
+void *burn(void *arg)
+{
+    volatile unsigned long spins = 0;
+    int i;
+
+    while (now() < deadline)
+	for (i = 0; i < 100000; i++)
+	    spins++;
+    return NULL;
+}
+
+/*
+ * forktree - Fork width children, each of which makes a tree of depth-1
+ *    below itself. Returns 1 in the process that called it, 0 in all
+ *    the others.
+ */
+int forktree(int width, int depth)
+{
+    pid_t pid;
+    int i;
+
+    if (depth == 0)
+	return 1;
+    for (i = 0; i < width; i++) {
+	if ((pid = fork()) < 0)
+	    unix_error("fork");
+	if (pid == 0) {
+	    forktree(width, depth - 1);
+	    return 0;
+	}
+    }
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    struct killat kills[MAXKILLS];
+    pthread_t threads[MAXTHREADS];
+    long long start = now(), ms = 1000, rate = -1, mb = 0;
+    long long t, wake, nextout;
+    int nkills = 0, nthreads = 0, width = 0, depth = 0, k = 0, c, i, n;
+    char line[LINELEN];
+    unsigned long nlines = 0;
+    char *mem, *at;
+
+    while ((c = getopt(argc, argv, "ht:c:m:o:f:k:")) != EOF) {
+	switch (c) {
+	case 't':
+	    ms = atoll(optarg);
+	    break;
+	case 'c':
+	    if ((nthreads = atoi(optarg)) > MAXTHREADS)
+		nthreads = MAXTHREADS;
+	    break;
+	case 'm':
+	    mb = atoll(optarg);
+	    break;
+	case 'o':
+	    rate = atoll(optarg);
+	    break;
+	case 'f':
+	    if (sscanf(optarg, "%dx%d", &width, &depth) != 2)
+		usage();
+	    break;
+	case 'k':
+	    if (nkills == MAXKILLS || (at = strchr(optarg, '@')) == NULL)
+		usage();
+	    *at = '\0';
+	    if ((kills[nkills].sig = parsesig(optarg)) < 0)
+		usage();
+	    kills[nkills++].at = atoll(at + 1) * 1000000LL;
+	    break;
+	default:
+	    usage();
+	}
+    }
+    deadline = start + ms * 1000000LL;
+    qsort(kills, nkills, sizeof(kills[0]), cmpkill);
+
+    /* only the process the shell started sends the -k signals */
+    if (width > 0 && !forktree(width, depth))
+	nkills = 0;
+
+    if (mb > 0) {
+	if ((mem = malloc(mb << 20)) == NULL)
+	    unix_error("malloc");
+	memset(mem, 1, mb << 20);
+    }
+    for (i = 0; i < nthreads; i++)
+	if ((errno = pthread_create(&threads[i], NULL, burn, NULL)) != 0)
+	    unix_error("pthread_create");
+
+    /* send the signals and write the output on time, until the deadline */
+    nextout = start;
+    while ((t = now()) < deadline) {
+	if (k < nkills && t >= start + kills[k].at) {
+	    kill(0, kills[k++].sig);
+	    continue;
+	}
+	if (rate >= 0 && t >= nextout) {
+	    memset(line, ' ', LINELEN);
+	    n = snprintf(line, LINELEN, "workload %d line %lu", (int)getpid(), ++nlines);
+	    line[n] = ' ';
+	    line[LINELEN - 1] = '\n';
+	    if (write(STDOUT_FILENO, line, LINELEN) < 0)
+		exit(1);
+	    if (rate > 0 && (nextout += LINELEN * 1000000000LL / rate) < t)
+		nextout = t;    /* don't make up for time spent stopped */
+	    continue;
+	}
+	wake = deadline;
+	if (rate >= 0 && nextout < wake)
+	    wake = nextout;
+	if (k < nkills && start + kills[k].at < wake)
+	    wake = start + kills[k].at;
+	sleepuntil(wake);
+    }
+    /* a signal due at the deadline is still sent, as mystop and myint do */
+    while (k < nkills && kills[k].at <= ms * 1000000LL)
+	kill(0, kills[k++].sig);
+
+    for (i = 0; i < nthreads; i++)
+	pthread_join(threads[i], NULL);
+    while (wait(NULL) > 0)
+	;
+    exit(0);
+}